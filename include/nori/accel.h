@@ -26,13 +26,14 @@ NORI_NAMESPACE_BEGIN
  * \brief Acceleration data structure for ray intersection queries
  *
  * The current implementation falls back to a brute force loop
- * through the geometry.
+ * through the geometry. Shapes whose bounding box is missed by
+ * the ray are skipped.
  */
 class Accel {
 public:
     /**
-     * \brief Register a triangle mesh for inclusion in the acceleration
-     * data structure
+     * \brief Register a shape (triangle mesh or analytic shape) for
+     * inclusion in the acceleration data structure
      *
      * This function can only be used before \ref build() is called
      */
@@ -66,8 +67,8 @@ public:
     bool rayIntersect(const Ray3f &ray, Intersection &its, bool shadowRay) const;
 
 private:
-    Mesh         *m_mesh = nullptr; ///< Mesh (only a single one for now)
-    BoundingBox3f m_bbox;           ///< Bounding box of the entire scene
+    std::vector<Mesh *> m_meshes; ///< Registered shapes
+    BoundingBox3f m_bbox;         ///< Bounding box of the entire scene
 };
 
 NORI_NAMESPACE_END
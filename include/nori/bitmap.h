@@ -20,9 +20,33 @@
 
 #include <nori/color.h>
 #include <nori/vector.h>
+#include <memory>
 
 NORI_NAMESPACE_BEGIN
 
+/// Settings of the OpenEXR files written by \ref Bitmap::saveEXR()
+struct EXROptions {
+    /// Compression methods (DWAA is lossy, the others are lossless)
+    enum ECompression {
+        ENone = 0,
+        EZIP,
+        EPIZ,
+        EDWAA
+    };
+
+    /// Compression method
+    ECompression compression = EZIP;
+
+    /// Store 16-bit half precision instead of 32-bit float values?
+    bool half = false;
+
+    /// Number of threads used to compress the data (-1: one per core, 0: none)
+    int threadCount = -1;
+
+    /// Parse the name of a compression method ("none", "zip", "piz" or "dwaa")
+    static ECompression parseCompression(const std::string &name);
+};
+
 /**
  * \brief Stores a RGB high dynamic-range bitmap
  *
@@ -44,11 +68,79 @@ public:
     /// Load an OpenEXR file with the specified filename
     Bitmap(const std::string &filename);
 
-    /// Save the bitmap as an EXR file with the specified filename
-    void saveEXR(const std::string &filename);
+    /**
+     * \brief Save the bitmap as an EXR file with the specified filename
+     *
+     * The scanlines are written in chunks that give every thread of
+     * OpenEXR's global thread pool one block of lines to compress.
+     * Reports the time taken and the size of the file.
+     */
+    void saveEXR(const std::string &filename, const EXROptions &options = EXROptions());
 
     /// Save the bitmap as a PNG file (with sRGB tonemapping) with the specified filename
     void savePNG(const std::string &filename);
 };
 
+/// Width and height of the tiles of files written by \ref TiledEXRWriter
+#define NORI_EXR_TILE_SIZE 64
+
+/// Number of complete tiles per thread that \ref TiledEXRWriter queues before adding parts waits
+#define NORI_EXR_QUEUED_TILES 4
+
+/**
+ * \brief Writes a tiled OpenEXR file from parts of the image that arrive
+ * in any order
+ *
+ * The parts (e.g. the pixels of finished render blocks) are copied into
+ * tiles of \ref NORI_EXR_TILE_SIZE pixels. Tiles that are complete are
+ * queued for a separate thread, which takes all queued tiles at once and
+ * writes each rectangle of adjacent ones with a single call, so that
+ * OpenEXR compresses the tiles of a rectangle in parallel. The file uses the \c RANDOM_Y
+ * line order, so OpenEXR does not buffer tiles that arrive early.
+ *
+ * Memory is held for the tiles that are partially filled and for at most
+ * \ref NORI_EXR_QUEUED_TILES complete tiles per thread, both in the queue
+ * and being written. When the queue is full, adding parts waits until the
+ * writing thread has taken the queued tiles.
+ */
+class TiledEXRWriter {
+public:
+    /**
+     * \brief Create a tiled OpenEXR file
+     * \param filename
+     *     Name of the file (without the extension)
+     * \param size
+     *     Size of the image
+     * \param options
+     *     Compression, pixel type and number of threads
+     */
+    TiledEXRWriter(const std::string &filename, const Vector2i &size,
+                   const EXROptions &options = EXROptions());
+
+    /// Release all resources (finishing the file if necessary)
+    ~TiledEXRWriter();
+
+    /**
+     * \brief Add the pixels of a part of the image (thread-safe)
+     *
+     * Every pixel must be added exactly once. Waits while too many
+     * complete tiles are queued for writing.
+     */
+    void put(const Point2i &offset, const Bitmap &pixels);
+
+    /// Wait until all tiles are written, finish the file and report its size
+    void close();
+
+protected:
+    /// Body of the thread that compresses and writes the finished tiles
+    void run();
+
+private:
+    struct File;
+    std::unique_ptr<File> m_file;
+    std::string m_filename;
+    Vector2i m_size;
+    Vector2i m_numTiles;
+};
+
 NORI_NAMESPACE_END
@@ -24,12 +24,46 @@
 
 #include <nori/color.h>
 #include <nori/vector.h>
+#include <nori/bbox.h>
+#include <nori/rfilter.h>
 #include <tbb/mutex.h>
+#include <atomic>
+#include <memory>
+#include <functional>
 
 #define NORI_BLOCK_SIZE 32 /* Block size used for parallelization */
 
 NORI_NAMESPACE_BEGIN
 
+/**
+ * \brief Per-pixel sample statistics
+ *
+ * Records the sum and the sum of squares of the luminance of all samples
+ * that fell into a pixel (without reconstruction filtering). This is used
+ * to estimate the variance of the pixel for adaptive sampling.
+ */
+struct PixelMoments {
+    float sum = 0.0f;
+    float sumSqr = 0.0f;
+    uint32_t count = 0;
+
+    /// Return the mean luminance of the samples
+    float getMean() const { return count > 0 ? sum / count : 0.0f; }
+
+    /// Return the variance of the mean (i.e. of the pixel estimate)
+    float getVarianceOfMean() const {
+        if (count < 2)
+            return 0.0f;
+        float mean = sum / count;
+        return std::max(0.0f, sumSqr / count - mean * mean) / (count - 1);
+    }
+
+    PixelMoments &operator+=(const PixelMoments &m) {
+        sum += m.sum; sumSqr += m.sumSqr; count += m.count;
+        return *this;
+    }
+};
+
 /**
  * \brief Weighted pixel storage for a rectangular subregion of an image
  *
@@ -85,17 +119,75 @@ public:
     /// Convert a bitmap into an image block
     void fromBitmap(const Bitmap &bitmap);
 
+    /**
+     * \brief Turn the per-pixel variance estimates into a bitmap
+     *
+     * Each pixel stores the estimated variance of the mean luminance
+     * of the pixel. Requires \ref setMomentsEnabled().
+     */
+    Bitmap *toVarianceBitmap() const;
+
     /// Clear all contents
-    void clear() { setConstant(Color4f()); }
+    void clear();
+
+    /**
+     * \brief Serialize the block to a binary stream
+     *
+     * Stores the offset, size and border size followed by the unnormalized
+     * pixel values (including filter weights and the border region) and
+     * the luminance moments, if any.
+     */
+    void save(std::ostream &os) const;
+
+    /**
+     * \brief Unserialize a block written by \ref save()
+     *
+     * The block takes on the offset, size and moments of the stored
+     * block. If the block has a reconstruction filter, its border size
+     * must match.
+     */
+    void load(std::istream &is);
+
+    /// Additionally record the luminance moments of each pixel?
+    void setMomentsEnabled(bool enabled);
+
+    /// Are luminance moments being recorded?
+    bool hasMoments() const { return !m_moments.empty(); }
 
-    /// Record a sample with the given position and radiance value
+    /// Return the luminance moments of a pixel (relative to the block offset)
+    const PixelMoments &getMoments(int x, int y) const {
+        return m_moments[y * m_momentsStride + x];
+    }
+
+    /// Return the luminance moments of a pixel (relative to the block offset)
+    PixelMoments &getMoments(int x, int y) {
+        return m_moments[y * m_momentsStride + x];
+    }
+
+    /**
+     * \brief Record a sample with the given position and radiance value
+     *
+     * The sample is weighted by the (separable) reconstruction filter.
+     * Box and tent filters are evaluated exactly, other filters use a
+     * tabulated version.
+     */
     void put(const Point2f &pos, const Color3f &value);
 
+    /**
+     * \brief Record a sample that only contributes to a single pixel
+     *
+     * Used with filter importance sampling (see \ref FilterSampler),
+     * where the filter has already been accounted for by the distribution
+     * of the samples and \c weight.
+     */
+    void putPixel(const Point2i &pixel, const Color3f &value, float weight = 1.0f);
+
     /**
      * \brief Merge another image block into this one
      *
      * During the merge operation, this function locks 
-     * the destination block using a mutex.
+     * the destination block using a mutex. Luminance moments
+     * are merged if both blocks record them.
      */
     void put(ImageBlock &b);
 
@@ -105,6 +197,28 @@ public:
     /// Unlock the image block
     inline void unlock() const { m_mutex.unlock(); }
 
+    /**
+     * \brief Return the number of horizontal stripes that can be locked
+     * individually
+     *
+     * Stripe \c i covers the rows <tt>[i, i+1) * NORI_BLOCK_SIZE</tt> of the
+     * block, and the border rows belong to the first and last stripe. This
+     * is used by \ref BlockAccumulator and the preview window, which
+     * therefore only contend when working on the same row of blocks.
+     */
+    int getStripeCount() const { return m_stripeCount; }
+
+    /// Return the stripe containing the given row (including the border)
+    int getStripe(int row) const {
+        return std::min(std::max(row - m_borderSize, 0) / NORI_BLOCK_SIZE, m_stripeCount - 1);
+    }
+
+    /// Lock a horizontal stripe of the image block
+    inline void lockStripe(int i) const { m_stripeMutexes[i].lock(); }
+
+    /// Unlock a horizontal stripe of the image block
+    inline void unlockStripe(int i) const { m_stripeMutexes[i].unlock(); }
+
     /// Return a human-readable string summary
     std::string toString() const;
 protected:
@@ -113,10 +227,263 @@ protected:
     int m_borderSize = 0;
     float *m_filter = nullptr;
     float m_filterRadius = 0;
+    ReconstructionFilter::EShape m_filterShape = ReconstructionFilter::EGeneric;
     float *m_weightsX = nullptr;
     float *m_weightsY = nullptr;
     float m_lookupFactor = 0;
+    std::vector<PixelMoments> m_moments;
+    int m_momentsStride = 0;
     mutable tbb::mutex m_mutex;
+    int m_stripeCount = 0;
+    mutable std::unique_ptr<tbb::mutex[]> m_stripeMutexes;
+};
+
+/**
+ * \brief Cost-aware block scheduler
+ *
+ * Like \ref BlockGenerator, this class chops up an image for parallel
+ * rendering, but it records how long each part took to render and uses
+ * this information in the following pass.
+ *
+ * The image is divided into \a cells of half the block size, which are
+ * the units that are rendered and merged (so the rendered image does not
+ * depend on how they are grouped). Work is handed out as tiles of 2x2
+ * cells. Without recorded costs, tiles are handed out in the spiral
+ * order of \ref BlockGenerator; otherwise the most expensive tiles are
+ * dispatched first. Once fewer tiles than workers remain, tiles are split
+ * into individual cells so that all workers stay busy until the end of
+ * the pass.
+ *
+ * Costs are only known after the cells have been rendered once. The
+ * renderer therefore times a cheap pre-pass (a few camera rays per cell)
+ * before the first pass, so that a render consisting of a single pass
+ * (the default) also benefits from the cost-based order.
+ */
+class BlockScheduler {
+public:
+    /**
+     * \brief Create a block scheduler
+     * \param size
+     *      Size of the image that should be split into blocks
+     * \param blockSize
+     *      Size of the tiles (cells have half this size)
+     * \param offset
+     *      Offset of the region within the full image
+     */
+    BlockScheduler(const Vector2i &size, int blockSize,
+                   const Point2i &offset = Point2i(0, 0));
+
+    /// Return the size of a cell in pixels
+    int getCellSize() const { return m_cellSize; }
+
+    /**
+     * \brief Restrict the scheduler to a subset of the tiles
+     *
+     * Tiles are numbered in scanline order, and only those whose index
+     * modulo \c count equals \c index are handed out. This interleaves
+     * the tiles of several processes that render parts of one image.
+     * Further calls split the remaining tiles in the same way. Must be
+     * called before rendering starts.
+     */
+    void setPartition(int index, int count);
+
+    /// Return the number of pixels covered by the scheduled tiles
+    uint64_t getPixelCount() const;
+
+    /**
+     * \brief Mark the cells of the scheduled tiles
+     *
+     * Sets the entries of the scheduled cells (in scanline order) to
+     * \c true, leaving the others unchanged, so that the partitions of
+     * several schedulers can be combined.
+     */
+    void markScheduledCells(std::vector<bool> &cells) const;
+
+    /**
+     * \brief Prepare for a new pass over the image
+     *
+     * Must not be called while work is being requested.
+     *
+     * \param costAware
+     *      Order tiles by the costs recorded since the previous reset
+     *      (if any) and split the final tiles? Otherwise, tiles are
+     *      handed out in spiral order and never split.
+     * \param workerCount
+     *      Number of threads that will be requesting work
+     */
+    void reset(bool costAware, int workerCount);
+
+    /**
+     * \brief Return the next range of cells to be rendered
+     *
+     * This function is thread-safe
+     *
+     * \return \c false if there were no more cells
+     */
+    bool next(BoundingBox2i &cells);
+
+    /// Configure the offset and size of an image block to match a cell
+    void configure(const Point2i &cell, ImageBlock &block) const;
+
+    /// Record the time taken to render a cell in the current pass
+    void setCost(const Point2i &cell, double cost) {
+        m_costs[cell.y() * m_numCells.x() + cell.x()] = cost;
+    }
+
+protected:
+    Point2i m_offset;
+    Vector2i m_size;
+    int m_blockSize;
+    int m_cellSize;
+    Vector2i m_numCells;
+    std::vector<Point2i> m_spiral;  ///< Tiles in spiral order
+    std::vector<Point2i> m_tiles;   ///< Tiles in the order of the current pass
+    std::vector<double> m_costs;    ///< Cost of each cell in the last pass
+    std::vector<Point2i> m_split;   ///< Cells of split tiles still to be handed out
+    size_t m_nextTile = 0;
+    int m_workerCount = 1;
+    bool m_costAware = false;
+    bool m_hasCosts = false;
+    tbb::mutex m_mutex;
+};
+
+/**
+ * \brief Deterministic accumulation of rendered blocks
+ *
+ * Merging blocks into the final image with \ref ImageBlock::put() locks
+ * the entire image, and the result depends on the order in which the
+ * (overlapping) borders of neighboring blocks are added.
+ *
+ * This class instead copies every finished block into a private slot.
+ * A block's pixels only receive contributions from the 3x3 neighboring
+ * blocks, so once all of them have been finished, the pixels are
+ * finalized by adding the neighbors' slots in a fixed order. Every pixel
+ * of the target is owned by exactly one block, and the result is
+ * bitwise identical regardless of thread scheduling.
+ */
+class BlockAccumulator {
+public:
+    /**
+     * \brief Create an accumulator for the blocks of a \ref BlockGenerator
+     * \param target
+     *      Image block receiving the results. Its size and offset
+     *      must match those passed to the block generator.
+     * \param blockSize
+     *      Maximum size of the individual blocks
+     */
+    BlockAccumulator(ImageBlock &target, int blockSize);
+
+    /**
+     * \brief Prepare for a new pass over all blocks
+     *
+     * Must not be called while blocks are being added. When \c extra is
+     * specified, finalized pixels are also added to this image block
+     * (e.g. to keep a separate sum of the even passes).
+     */
+    void reset(ImageBlock *extra = nullptr);
+
+    /**
+     * \brief Only expect the given blocks (e.g. the tiles of one process
+     * of a distributed render)
+     *
+     * \c scheduled holds a flag for every block in scanline order (see
+     * \ref BlockScheduler::markScheduledCells()). A block is finalized
+     * once its scheduled neighbors have been added. This includes
+     * blocks that are not scheduled themselves but receive part of the
+     * filter footprint of a scheduled neighbor, so that summing the
+     * results of all partitions yields the complete image. Takes effect
+     * with the next call to \ref reset().
+     */
+    void setScheduled(const std::vector<bool> &scheduled);
+
+    /// Add a rendered block (thread-safe, each block once per pass)
+    void put(const ImageBlock &block);
+
+protected:
+    /// Sum the contributions of all neighbors of block \c (x, y)
+    void finalize(int x, int y);
+
+protected:
+    typedef Eigen::Array<Color4f, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> Storage;
+
+    ImageBlock &m_target;
+    ImageBlock *m_extra = nullptr;
+    int m_blockSize;
+    int m_borderSize;
+    Vector2i m_numBlocks;
+    std::vector<Storage> m_slots;
+    std::vector<Vector2i> m_slotSizes;
+    std::vector<bool> m_scheduled;  ///< Blocks that are rendered (empty: all)
+    std::unique_ptr<std::atomic<int>[]> m_pending;
+};
+
+/**
+ * \brief Accumulation of rendered blocks without a full-frame buffer
+ *
+ * Works like \ref BlockAccumulator (for a single pass), but there is no
+ * target image: once a block and its neighbors have been added, the
+ * pixels owned by the block are normalized and passed to a callback,
+ * e.g. to write them to a tiled file. A block is released as soon as
+ * all of its neighbors have been finalized, so only the blocks around
+ * the ones still being rendered are kept in memory.
+ */
+class StreamingAccumulator {
+public:
+    /**
+     * \brief Receives the normalized pixels owned by a block
+     *
+     * Called by the thread that added the last missing block, and
+     * possibly by several threads at once.
+     */
+    typedef std::function<void(const Point2i &block, const Bitmap &pixels)> Callback;
+
+    /**
+     * \brief Create a streaming accumulator
+     * \param size
+     *      Size of the image (region) that is being rendered
+     * \param offset
+     *      Offset of the region within the full image
+     * \param blockSize
+     *      Maximum size of the individual blocks
+     * \param filter
+     *      Reconstruction filter of the blocks
+     * \param callback
+     *      Receives the finished parts of the image
+     */
+    StreamingAccumulator(const Vector2i &size, const Point2i &offset, int blockSize,
+                         const ReconstructionFilter *filter, const Callback &callback);
+
+    /// Add a rendered block (thread-safe, each block once)
+    void put(const ImageBlock &block);
+
+    /// Return the largest number of bytes that were held at any time
+    size_t getPeakMemory() const { return m_peakMemory; }
+
+protected:
+    /// Sum the contributions of all neighbors of block \c (x, y) and pass them on
+    void finalize(int x, int y);
+
+    /// Call a function for each block in the 3x3 neighborhood of block \c (x, y)
+    template <typename Functor> void forNeighbors(int x, int y, const Functor &f) const {
+        for (int ny=std::max(y - 1, 0); ny<=std::min(y + 1, m_numBlocks.y() - 1); ++ny)
+            for (int nx=std::max(x - 1, 0); nx<=std::min(x + 1, m_numBlocks.x() - 1); ++nx)
+                f(nx, ny);
+    }
+
+protected:
+    typedef Eigen::Array<Color4f, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> Storage;
+
+    Point2i m_offset;
+    Vector2i m_size;
+    int m_blockSize;
+    int m_borderSize;
+    Vector2i m_numBlocks;
+    Callback m_callback;
+    std::vector<std::unique_ptr<Storage>> m_slots;
+    std::unique_ptr<std::atomic<int>[]> m_pending;  ///< Neighbors yet to be added
+    std::unique_ptr<std::atomic<int>[]> m_users;    ///< Neighbors yet to be finalized
+    std::atomic<size_t> m_memory;
+    std::atomic<size_t> m_peakMemory;
 };
 
 /**
@@ -135,8 +502,12 @@ public:
      *      Size of the image that should be split into blocks
      * \param blockSize
      *      Maximum size of the individual blocks
+     * \param offset
+     *      Offset of the region within the full image (e.g. when
+     *      rendering a crop window)
      */
-    BlockGenerator(const Vector2i &size, int blockSize);
+    BlockGenerator(const Vector2i &size, int blockSize,
+                   const Point2i &offset = Point2i(0, 0));
     
     /**
      * \brief Return the next block to be rendered
@@ -154,6 +525,7 @@ protected:
 
     Point2i m_block;
     Vector2i m_numBlocks;
+    Point2i m_offset;
     Vector2i m_size;
     int m_blockSize;
     int m_numSteps;
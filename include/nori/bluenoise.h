@@ -0,0 +1,47 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/common.h>
+
+NORI_NAMESPACE_BEGIN
+
+/// Resolution of the (tileable) blue noise dither mask
+#define NORI_BLUE_NOISE_SIZE 64
+
+/**
+ * \brief Return a blue noise dither mask value as a 32-bit binary fraction
+ *
+ * The mask is generated with the void-and-cluster method (Ulichney 1993)
+ * on the first call and tiles the image plane. Every \c component reads
+ * the mask with a different toroidal offset, so that the values of
+ * different sample components are decorrelated while each of them is
+ * distributed as blue noise across neighboring pixels.
+ *
+ * Samplers that give all pixels the same sequence can decorrelate them
+ * by XOR-ing these values into the sample components (a digital shift).
+ * This pushes the error of low sample count renders to high frequencies
+ * (similar to the dithered sampling of Georgiev and Fajardo, SIGGRAPH
+ * 2016 Talks), and unlike a Cranley-Patterson rotation, it maps
+ * elementary intervals onto each other and preserves the stratification
+ * of the sequence.
+ */
+extern uint32_t getBlueNoiseMask(const Point2i &pixel, uint32_t component);
+
+NORI_NAMESPACE_END
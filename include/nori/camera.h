@@ -60,6 +60,14 @@ public:
     /// Return the size of the output image in pixels
     const Vector2i &getOutputSize() const { return m_outputSize; }
 
+    /**
+     * \brief Change the size of the output image in pixels
+     *
+     * \ref activate() must be called again afterwards so that the
+     * camera can update any derived quantities.
+     */
+    void setOutputSize(const Vector2i &size) { m_outputSize = size; }
+
     /// Return the camera's reconstruction filter in image space
     const ReconstructionFilter *getReconstructionFilter() const { return m_rfilter; }
 
@@ -181,12 +181,28 @@ extern std::vector<std::string> tokenize(const std::string &s, const std::string
 /// Check if a string ends with another string
 extern bool endsWith(const std::string &value, const std::string &ending);
 
+/**
+ * \brief Remove the extension from the last component of a path
+ *
+ * Dots in directory names (e.g. <tt>../renders/image</tt>) and leading
+ * dots of the filename (e.g. <tt>.hidden</tt>) are left untouched.
+ */
+extern std::string stripExtension(const std::string &path);
+
 /// Convert a time value in milliseconds into a human-readable string
 extern std::string timeString(double time, bool precise = false);
 
 /// Convert a memory amount in bytes into a human-readable string
 extern std::string memString(size_t size, bool precise = false);
 
+/**
+ * \brief Print a line of text to the console
+ *
+ * This function is thread-safe: lines printed by concurrent callers (e.g.
+ * meshes that are loaded in parallel) are never interleaved.
+ */
+extern void logMessage(const std::string &message);
+
 /// Measures associated with probability distributions
 enum EMeasure {
     EUnknownMeasure = 0,
@@ -0,0 +1,103 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/common.h>
+
+NORI_NAMESPACE_BEGIN
+
+/* Integer hashing and scrambling utilities used by the samplers */
+
+/// Reverse the order of the bits of a 32-bit integer
+inline uint32_t reverseBits(uint32_t x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+    x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+/// 32-bit integer hash (the finalizer of MurmurHash3)
+inline uint32_t hashInt(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x85ebca6bu;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35u;
+    x ^= x >> 16;
+    return x;
+}
+
+/// Combine a hash value with another integer
+inline uint32_t hashCombine(uint32_t seed, uint32_t value) {
+    return hashInt(seed ^ (value + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+/**
+ * \brief Counter-based hash of four integers to four pseudorandom integers
+ * (the \c pcg4d function by Jarzynski and Olano, "Hash Functions for GPU
+ * Rendering", JCGT 2020)
+ */
+inline void pcg4d(uint32_t v[4]) {
+    for (int i = 0; i < 4; ++i)
+        v[i] = v[i] * 1664525u + 1013904223u;
+    v[0] += v[1] * v[3]; v[1] += v[2] * v[0];
+    v[2] += v[0] * v[1]; v[3] += v[1] * v[2];
+    for (int i = 0; i < 4; ++i)
+        v[i] ^= v[i] >> 16;
+    v[0] += v[1] * v[3]; v[1] += v[2] * v[0];
+    v[2] += v[0] * v[1]; v[3] += v[1] * v[2];
+}
+
+/**
+ * \brief Hash-based permutation in which every bit only depends on the
+ * bits below it (Laine and Karras, improved constants by Burley)
+ */
+inline uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+/**
+ * \brief Owen scramble of a binary fraction (the most significant bit
+ * comes first)
+ *
+ * Maps every elementary interval to another one, so that stratified
+ * point sets remain stratified. Applied to a sample index, it shuffles
+ * the indices within every aligned block of a power-of-two size.
+ */
+inline uint32_t nestedUniformScramble(uint32_t x, uint32_t seed) {
+    return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+}
+
+/**
+ * \brief Map a 32-bit binary fraction to a floating point value in [0, 1)
+ *
+ * Truncates to the 24 bits that a float can represent exactly. Rounding
+ * instead could move a point onto the boundary of the next elementary
+ * interval and break the stratification of the sample sets.
+ */
+inline float fractionToFloat(uint32_t x) {
+    return (x >> 8) * 5.9604644775390625e-8f;
+}
+
+NORI_NAMESPACE_END
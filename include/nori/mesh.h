@@ -21,9 +21,17 @@
 #include <nori/object.h>
 #include <nori/frame.h>
 #include <nori/bbox.h>
+#include <nori/numa.h>
 
 NORI_NAMESPACE_BEGIN
 
+/// Geometry shared by the meshes loaded from the same file (see \ref Mesh::setCacheEnabled())
+struct CachedGeometry {
+    MatrixXf V, N, UV;
+    MatrixXu F, Q;
+    BoundingBox3f bbox;
+};
+
 /**
  * \brief Intersection data structure
  *
@@ -70,6 +78,13 @@ struct Intersection {
  * for querying the individual triangles. Subclasses of \c Mesh implement
  * the specifics of how to create its contents (e.g. by loading from an
  * external file)
+ *
+ * Meshes may additionally contain quads, which are kept as native bilinear
+ * patches instead of being split into pairs of triangles.
+ *
+ * Analytic shapes (e.g. spheres) derive from this class as well and
+ * override the virtual per-primitive queries, which lets them share the
+ * acceleration data structure, BSDF and emitter handling with meshes.
  */
 class Mesh : public NoriObject {
 public:
@@ -80,34 +95,58 @@ public:
     virtual void activate();
 
     /// Return the total number of triangles in this hsape
-    uint32_t getTriangleCount() const { return (uint32_t) m_F.cols(); }
+    uint32_t getTriangleCount() const { return (uint32_t) getIndices().cols(); }
+
+    /// Return the total number of quads in this shape
+    uint32_t getQuadCount() const { return (uint32_t) getQuadIndices().cols(); }
+
+    /**
+     * \brief Return the total number of primitives in this shape
+     *
+     * Primitives are numbered with the triangles first, followed by the
+     * quads: primitive \c index refers to quad <tt>index - getTriangleCount()</tt>
+     * whenever \ref isQuad() returns \c true.
+     */
+    virtual uint32_t getPrimitiveCount() const { return getTriangleCount() + getQuadCount(); }
+
+    /// Is the given primitive a quad?
+    bool isQuad(uint32_t index) const { return index >= getTriangleCount(); }
 
     /// Return the total number of vertices in this hsape
-    uint32_t getVertexCount() const { return (uint32_t) m_V.cols(); }
+    uint32_t getVertexCount() const { return (uint32_t) getVertexPositions().cols(); }
 
-    /// Return the surface area of the given triangle
-    float surfaceArea(uint32_t index) const;
+    /**
+     * \brief Return the surface area of the given primitive
+     *
+     * The area of a non-planar quad is approximated by that of
+     * the two triangles spanned by its vertices.
+     */
+    virtual float surfaceArea(uint32_t index) const;
 
     //// Return an axis-aligned bounding box of the entire mesh
     const BoundingBox3f &getBoundingBox() const { return m_bbox; }
 
-    //// Return an axis-aligned bounding box containing the given triangle
-    BoundingBox3f getBoundingBox(uint32_t index) const;
+    //// Return an axis-aligned bounding box containing the given primitive
+    virtual BoundingBox3f getBoundingBox(uint32_t index) const;
 
-    //// Return the centroid of the given triangle
-    Point3f getCentroid(uint32_t index) const;
+    //// Return the centroid of the given primitive
+    virtual Point3f getCentroid(uint32_t index) const;
 
-    /** \brief Ray-triangle intersection test
+    /** \brief Ray-primitive intersection test
      *
-     * Uses the algorithm by Moeller and Trumbore discussed at
-     * <tt>http://www.acm.org/jgt/papers/MollerTrumbore97/code.html</tt>.
+     * Triangles are intersected using the algorithm by Moeller and Trumbore
+     * discussed at <tt>http://www.acm.org/jgt/papers/MollerTrumbore97/code.html</tt>.
+     * Quads are treated as bilinear patches and intersected using the
+     * algorithm by Reshetov ("Cool Patches: A Geometric Approach to
+     * Ray/Bilinear Patch Intersections", Ray Tracing Gems, 2019), which
+     * also handles planar quads exactly.
      *
-     * Note that the test only applies to a single triangle in the mesh.
+     * Note that the test only applies to a single primitive in the mesh.
      * An acceleration data structure like \ref BVH is needed to search
-     * for intersections against many triangles.
+     * for intersections against many primitives.
      *
      * \param index
-     *    Index of the triangle that should be intersected
+     *    Index of the primitive that should be intersected
      * \param ray
      *    The ray segment to be used for the intersection query
      * \param t
@@ -115,26 +154,50 @@ public:
      *    intersection point,
      * \param u
      *   Upon success, \c u will contain the 'U' component of the intersection
-     *   in barycentric coordinates
+     *   in barycentric coordinates (triangles) or patch coordinates (quads)
      * \param v
      *   Upon success, \c v will contain the 'V' component of the intersection
-     *   in barycentric coordinates
+     *   in barycentric coordinates (triangles) or patch coordinates (quads)
      * \return
      *   \c true if an intersection has been detected
      */
-    bool rayIntersect(uint32_t index, const Ray3f &ray, float &u, float &v, float &t) const;
+    virtual bool rayIntersect(uint32_t index, const Ray3f &ray, float &u, float &v, float &t) const;
+
+    /**
+     * \brief Compute the remaining properties of an intersection
+     *
+     * Given the \c t and \c uv values reported by \ref rayIntersect() for
+     * primitive \c index (stored in \c its.t and \c its.uv), this function
+     * computes the position, texture coordinates and the geometric and
+     * shading frames of the intersection.
+     */
+    virtual void setHitInformation(uint32_t index, const Ray3f &ray, Intersection &its) const;
+
+    /**
+     * \brief Reorder the mesh to improve the memory locality of
+     * intersection queries
+     *
+     * Sorts the triangles and quads along a Morton (Z-order) curve through
+     * their centroids and renumbers the vertices in the order in which they
+     * are first referenced. Degenerate primitives and unreferenced vertices
+     * are discarded, and the bounding box is recomputed.
+     */
+    void optimize();
 
     /// Return a pointer to the vertex positions
-    const MatrixXf &getVertexPositions() const { return m_V; }
+    const MatrixXf &getVertexPositions() const { return m_cached ? m_cached->V : m_V; }
 
     /// Return a pointer to the vertex normals (or \c nullptr if there are none)
-    const MatrixXf &getVertexNormals() const { return m_N; }
+    const MatrixXf &getVertexNormals() const { return m_cached ? m_cached->N : m_N; }
 
     /// Return a pointer to the texture coordinates (or \c nullptr if there are none)
-    const MatrixXf &getVertexTexCoords() const { return m_UV; }
+    const MatrixXf &getVertexTexCoords() const { return m_cached ? m_cached->UV : m_UV; }
 
     /// Return a pointer to the triangle vertex index list
-    const MatrixXu &getIndices() const { return m_F; }
+    const MatrixXu &getIndices() const { return m_cached ? m_cached->F : m_F; }
+
+    /// Return a pointer to the quad vertex index list
+    const MatrixXu &getQuadIndices() const { return m_cached ? m_cached->Q : m_Q; }
 
     /// Is this mesh an area emitter?
     bool isEmitter() const { return m_emitter != nullptr; }
@@ -163,19 +226,93 @@ public:
      * */
     EClassType getClassType() const { return EMesh; }
 
+    /**
+     * \brief Enable or disable the geometry cache
+     *
+     * When enabled (e.g. by the render server), shapes that are loaded
+     * from files keep their processed geometry. It is keyed by
+     * the file, its size and modification time, and the parameters that
+     * affect loading (e.g. the transformation). Shapes with the same key
+     * share the cached geometry (without copying it) instead of
+     * reloading the file.
+     */
+    static void setCacheEnabled(bool enabled);
+
+    /// Drop cached geometry that was not used since the last call
+    static void pruneCache();
+
+    /// Prepare for replication into \c nodeCount NUMA nodes (0: release all copies)
+    void setReplicaCount(int nodeCount);
+
+    /**
+     * \brief Replicate the primitive data into the memory of a NUMA node
+     *
+     * Must be called by a thread of the node's \ref NumaArenas arena
+     * (the pages are placed on first touch). Afterwards, intersection
+     * queries made by threads of that node read the local copy.
+     * Analytic shapes with their own storage are not replicated.
+     *
+     * \return
+     *    The size of the copy in bytes
+     */
+    size_t replicate(int node);
+
 protected:
     /// Create an empty mesh
     Mesh();
 
+    /**
+     * \brief Return the key of a file in the geometry cache
+     *
+     * \param filename
+     *    File from which the geometry is loaded
+     * \param params
+     *    Further parameters that affect the loaded geometry
+     * \return
+     *    The key, or an empty string if the cache is disabled
+     */
+    static std::string getCacheKey(const std::string &filename, const std::string &params);
+
+    /// Initialize the geometry from the cache; returns \c false on a miss or empty key
+    bool loadFromCache(const std::string &key);
+
+    /**
+     * \brief Move the geometry into the cache (no-op for an empty key)
+     *
+     * The mesh then references the cached geometry like meshes that
+     * are later initialized from it by \ref loadFromCache().
+     */
+    void storeInCache(const std::string &key);
+
+    /// Copy of the primitive data in the memory of a NUMA node
+    struct Replica {
+        MatrixXf V, N, UV;
+        MatrixXu F, Q;
+    };
+
+    /// Return the copy of a buffer that is local to the calling thread's NUMA node
+    template <typename T> const T &local(const T &buffer, T Replica::*member) const {
+        if (m_replicas.empty())
+            return buffer;
+        int node = getNumaNodeIndex();
+        return node >= 0 && m_replicas[node] ? m_replicas[node].get()->*member : buffer;
+    }
+
+    /// Ray-quad intersection test (\c index refers to a column of \ref m_Q)
+    bool rayIntersectQuad(uint32_t index, const Ray3f &ray, float &u, float &v, float &t) const;
+
 protected:
     std::string m_name;                  ///< Identifying name
     MatrixXf      m_V;                   ///< Vertex positions
     MatrixXf      m_N;                   ///< Vertex normals
     MatrixXf      m_UV;                  ///< Vertex texture coordinates
     MatrixXu      m_F;                   ///< Faces
+    MatrixXu      m_Q;                   ///< Quad faces
+    std::shared_ptr<const CachedGeometry> m_cached; ///< Shared geometry that replaces the above, if any
     BSDF         *m_bsdf = nullptr;      ///< BSDF of the surface
     Emitter    *m_emitter = nullptr;     ///< Associated emitter, if any
     BoundingBox3f m_bbox;                ///< Bounding box of the mesh
+    std::vector<std::unique_ptr<Replica>> m_replicas; ///< NUMA-local copies
 };
 
 NORI_NAMESPACE_END
@@ -0,0 +1,84 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/common.h>
+#include <functional>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Return the CPUs of each NUMA node of the machine
+ *
+ * The topology is read from \c /sys on Linux. On other platforms (or
+ * if it cannot be determined), the result is empty.
+ */
+extern std::vector<std::vector<int>> getNumaNodes();
+
+/**
+ * \brief Return the NUMA node whose arena the calling thread is working in
+ *
+ * Returns -1 for threads outside of a \ref NumaArenas instance.
+ */
+extern int getNumaNodeIndex();
+
+/**
+ * \brief One TBB task arena per NUMA node
+ *
+ * The threads of each arena are pinned to the CPUs of its node (Linux
+ * only), so that the memory they allocate and touch first is local to
+ * the node. The requested number of threads is split between the nodes
+ * in proportion to their CPU counts.
+ */
+class NumaArenas {
+public:
+    /// Create the arenas for a total of \c threadCount threads
+    NumaArenas(int threadCount);
+
+    /// Release the arenas
+    ~NumaArenas();
+
+    /// Return the number of NUMA nodes (at least one)
+    int getNodeCount() const { return (int) m_nodes.size(); }
+
+    /// Return the number of threads working on the given node
+    int getConcurrency(int node) const;
+
+    /// Return the total number of threads
+    int getConcurrency() const;
+
+    /**
+     * \brief Call \c func(node) in the arena of every node
+     *
+     * The nodes are processed in parallel, and parallel algorithms
+     * started by \c func only use the threads of the node. Returns once
+     * all nodes are done and rethrows the first exception, if any.
+     */
+    void execute(const std::function<void(int)> &func);
+
+    /// Return a human-readable summary
+    std::string toString() const;
+
+private:
+    struct Node;
+    std::vector<std::unique_ptr<Node>> m_nodes;
+};
+
+NORI_NAMESPACE_END
@@ -25,7 +25,13 @@ NORI_NAMESPACE_BEGIN
 /**
  * \brief Load a scene from the specified filename and
  * return its root object
+ *
+ * \param parallel
+ *    When set to \c true, <tt>&lt;mesh&gt;</tt> nodes are constructed
+ *    and activated concurrently using TBB tasks. The order in which
+ *    children are registered with their parent is the same as in
+ *    sequential mode (i.e. the document order).
  */
-extern NoriObject *loadFromXML(const std::string &filename);
+extern NoriObject *loadFromXML(const std::string &filename, bool parallel = true);
 
 NORI_NAMESPACE_END
@@ -0,0 +1,156 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/vector.h>
+#include <nori/color.h>
+#include <tbb/mutex.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <fstream>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/// A single image sample: film position (in pixels) and radiance
+struct RawSample {
+    Point2f position;
+    Color3f value;
+};
+
+/**
+ * \brief Header of a raw sample file
+ *
+ * The header is followed by a sequence of chunks, each holding the
+ * samples of one cell of the \ref BlockScheduler grid that were taken
+ * in one pass: the cell coordinates and the number of samples (three
+ * 32-bit integers), followed by the sample records.
+ *
+ * Positions are stored relative to the offset of the cell. Records are
+ * either five floats (position and radiance) or, if \c quantized is set,
+ * 8 bytes: the position in 16-bit fixed point and the radiance in
+ * Ward's shared exponent (RGBE) format.
+ */
+struct RawSampleHeader {
+    char magic[4];
+    uint32_t quantized;
+    int32_t cellSize;
+    int32_t cropOffset[2];
+    int32_t cropSize[2];
+};
+
+/**
+ * \brief Streams the samples of a render to a file, so that they can
+ * later be filtered with a different reconstruction filter (see the
+ * \c nori-refilter tool)
+ */
+class RawSampleWriter {
+public:
+    /**
+     * \brief Create a raw sample file
+     * \param filename
+     *     Name of the file, which is overwritten if it exists
+     * \param cropOffset
+     *     Offset of the rendered region within the image
+     * \param cropSize
+     *     Size of the rendered region
+     * \param cellSize
+     *     Size of the cells (see \ref BlockScheduler::getCellSize())
+     * \param quantized
+     *     Store compact quantized records?
+     */
+    RawSampleWriter(const std::string &filename, const Point2i &cropOffset,
+                    const Vector2i &cropSize, int cellSize, bool quantized);
+
+    /// Append the samples of a cell (thread-safe)
+    void write(const Point2i &cell, const std::vector<RawSample> &samples);
+
+    /// Flush and close the file (throws if any write failed)
+    void close();
+
+    /// Return the number of samples written so far
+    uint64_t getSampleCount() const { return m_sampleCount; }
+
+    /// Return the number of bytes written so far
+    uint64_t getSize() const { return m_size; }
+
+private:
+    std::string m_filename;
+    std::ofstream m_os;
+    RawSampleHeader m_header;
+    uint64_t m_sampleCount = 0;
+    uint64_t m_size = 0;
+    tbb::mutex m_mutex;
+};
+
+/**
+ * \brief Reads the raw sample files of one image
+ *
+ * Several files (e.g. those of distributed render jobs) can be combined
+ * as long as they cover the same region using the same cell size. The
+ * constructor scans the chunk headers, after which the samples of every
+ * cell can be read independently and in parallel.
+ */
+class RawSampleReader {
+public:
+    /// Open and index the given files
+    RawSampleReader(const std::vector<std::string> &filenames);
+
+    /// Return the offset of the region covered by the samples
+    Point2i getCropOffset() const { return Point2i(m_header.cropOffset[0], m_header.cropOffset[1]); }
+
+    /// Return the size of the region covered by the samples
+    Vector2i getCropSize() const { return Vector2i(m_header.cropSize[0], m_header.cropSize[1]); }
+
+    /// Return the size of the cells that the samples are grouped into
+    int getCellSize() const { return m_header.cellSize; }
+
+    /// Return the number of cells in each direction
+    const Vector2i &getCellCount() const { return m_cellCount; }
+
+    /// Return the total number of samples
+    uint64_t getSampleCount() const { return m_sampleCount; }
+
+    /**
+     * \brief Read all samples of a cell (in file order)
+     *
+     * This function is thread-safe: every thread uses its own streams.
+     */
+    void read(const Point2i &cell, std::vector<RawSample> &samples) const;
+
+private:
+    /// Location of a chunk within the files
+    struct Chunk {
+        uint32_t file;
+        uint32_t count;
+        uint64_t position;
+    };
+
+    typedef std::vector<std::unique_ptr<std::ifstream>> Streams;
+
+    std::vector<std::string> m_filenames;
+    std::vector<bool> m_quantized;
+    RawSampleHeader m_header;
+    Vector2i m_cellCount;
+    std::vector<std::vector<Chunk>> m_chunks;  ///< Chunks of each cell
+    uint64_t m_sampleCount = 0;
+    mutable tbb::enumerable_thread_specific<Streams> m_streams;
+    mutable tbb::enumerable_thread_specific<std::vector<char>> m_buffers;
+};
+
+NORI_NAMESPACE_END
@@ -0,0 +1,204 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/bitmap.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Settings of a rendering job
+ *
+ * Most of these are overrides of the values specified in the
+ * scene description that can be provided on the command line.
+ */
+struct RenderOptions {
+    /// Render without opening a preview window (no GUI / OpenGL context)
+    bool headless = false;
+
+    /// Number of worker threads (-1: one per core)
+    int threadCount = -1;
+
+    /// Number of samples per pixel (0: use the sampler's setting)
+    int sampleCount = 0;
+
+    /// Output resolution in pixels (zero: use the camera's setting)
+    Vector2i resolution = Vector2i::Zero();
+
+    /// Offset of the crop window in pixels
+    Point2i cropOffset = Point2i::Zero();
+
+    /// Size of the crop window in pixels (zero: render the full image)
+    Vector2i cropSize = Vector2i::Zero();
+
+    /// Output filename (empty: derived from the scene filename)
+    std::string outputName;
+
+    /// Settings of the OpenEXR output (written using \ref threadCount threads)
+    EXROptions exrOptions;
+
+    /**
+     * \brief Stream finished tiles to a tiled OpenEXR file instead of
+     * keeping the full image in memory
+     *
+     * Only the blocks around those still being rendered are held in
+     * memory (see \ref StreamingAccumulator). No PNG file is written.
+     * Requires a headless render in a single pass.
+     */
+    bool streamingOutput = false;
+
+    /**
+     * \brief Number of samples per pixel and pass
+     *
+     * When nonzero, the image is rendered progressively in passes of this
+     * many samples, until the total sample count of the sampler has been
+     * reached or one of the budgets below is exhausted.
+     */
+    int passSampleCount = 0;
+
+    /// Wall-clock budget of a progressive render in seconds (0: unlimited)
+    float timeBudget = 0.0f;
+
+    /// Stop a progressive render once the estimated relative noise falls below this value (0: disabled)
+    float noiseThreshold = 0.0f;
+
+    /**
+     * \brief Target relative error of adaptive sampling (0: disabled)
+     *
+     * After a first uniform pass, the samples of every further pass are
+     * distributed according to the estimated relative error of each pixel,
+     * until all pixels fall below this threshold or the sample or time
+     * budget has been used up. \ref noiseThreshold is ignored in this mode.
+     */
+    float adaptiveThreshold = 0.0f;
+
+    /// Also write the estimated per-pixel variance to <tt>&lt;output&gt;_variance.exr</tt>
+    bool varianceOutput = false;
+
+    /// Hand out blocks in spiral order instead of using the cost-aware schedule
+    bool spiralScheduling = false;
+
+    /**
+     * \brief Importance sample the reconstruction filter instead of splatting
+     *
+     * Pixel samples are distributed according to the filter (see \ref
+     * FilterSampler) and every sample is added to the pixel it was
+     * generated for. Image blocks then need no border regions.
+     */
+    bool filterSampling = false;
+
+    /**
+     * \brief Stream the position and value of every sample to
+     * <tt>&lt;output&gt;.raw</tt>
+     *
+     * The \c nori-refilter tool reconstructs images from these files
+     * with a different reconstruction filter. Cannot be combined with
+     * \ref filterSampling or \ref resume.
+     */
+    bool rawSamples = false;
+
+    /// Quantize the raw samples (8 instead of 20 bytes per sample)
+    bool rawQuantization = false;
+
+    /**
+     * \brief Interval between checkpoints in seconds (0: disabled)
+     *
+     * Checkpoints are taken at the end of a pass and written in the
+     * background to <tt>&lt;output&gt;.checkpoint</tt>. A final checkpoint
+     * is written when rendering finishes. Unless \ref passSampleCount is
+     * specified, the samples are split into 16 passes (also when resuming).
+     */
+    float checkpointInterval = 0.0f;
+
+    /// Continue from the checkpoint written by a previous run
+    bool resume = false;
+
+    /// Interval between tonemapped snapshots written to <tt>&lt;output&gt;_snapshot.png</tt> (0: disabled)
+    float snapshotInterval = 0.0f;
+
+    /**
+     * \brief Distributed rendering: only render the tiles whose scanline
+     * index modulo \ref tilePartCount equals \ref tilePartIndex
+     */
+    int tilePartIndex = 0;
+
+    /// Number of processes that the tiles are split between (1: render all tiles)
+    int tilePartCount = 1;
+
+    /**
+     * \brief Distributed rendering: only render the passes whose index
+     * modulo \ref passPartCount equals \ref passPartIndex
+     *
+     * The passes are determined by \ref passSampleCount.
+     */
+    int passPartIndex = 0;
+
+    /// Number of processes that the passes are split between (1: render all passes)
+    int passPartCount = 1;
+
+    /**
+     * \brief Is this job rendering part of a distributed image?
+     *
+     * Such jobs write the unnormalized accumulation buffer (including the
+     * filter weights) to <tt>&lt;output&gt;.partial</tt> instead of EXR
+     * and PNG files. The partial buffers of all jobs are summed by the
+     * \c nori-merge tool.
+     */
+    bool isPartial() const { return tilePartCount > 1 || passPartCount > 1; }
+
+    /**
+     * \brief Run one pinned thread arena per NUMA node
+     *
+     * The tiles are split between the nodes, so that every node works
+     * on its own part of the image (Linux only, no effect elsewhere).
+     */
+    bool numa = false;
+
+    /// Additionally copy the mesh data into the local memory of every NUMA node
+    bool numaReplication = false;
+
+    /// Interval between progress reports in headless mode (in seconds)
+    float progressInterval = 1.0f;
+};
+
+/**
+ * \brief Render a scene and write the result to disk
+ *
+ * Applies the overrides in \c options, renders the scene in parallel and
+ * stores the result as an OpenEXR and a tonemapped PNG file. Unless the
+ * job is headless, the partially rendered image is shown in a window.
+ *
+ * In progressive mode, the noise is estimated by comparing the images
+ * accumulated by the even and the odd passes.
+ *
+ * Scenes with several cameras are rendered view by view, and the output
+ * files get the suffix <tt>_&lt;view index&gt;</tt>. The files of a view
+ * are written in the background while the next one is being rendered.
+ *
+ * \param scene
+ *    The scene to be rendered
+ * \param filename
+ *    Filename of the scene description; used to derive the name
+ *    of the output file unless \c options specifies one
+ * \param options
+ *    Settings of the rendering job
+ */
+extern void render(Scene *scene, const std::string &filename, const RenderOptions &options);
+
+NORI_NAMESPACE_END
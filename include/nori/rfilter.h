@@ -19,10 +19,14 @@
 #pragma once
 
 #include <nori/object.h>
+#include <nori/dpdf.h>
 
 /// Reconstruction filters will be tabulated at this resolution
 #define NORI_FILTER_RESOLUTION 32
 
+/// Resolution of the tabulated distribution used for filter importance sampling
+#define NORI_FILTER_SAMPLING_RESOLUTION 256
+
 NORI_NAMESPACE_BEGIN
 
 /**
@@ -45,6 +49,21 @@ public:
     /// Evaluate the filter function
     virtual float eval(float x) const = 0;
 
+    /// Filters that \ref ImageBlock can splat in closed form
+    enum EShape {
+        EGeneric = 0,
+        EBox,
+        ETent
+    };
+
+    /**
+     * \brief Return the shape of the filter
+     *
+     * Box and tent filters are splatted with exact and faster special
+     * cases instead of the tabulated filter.
+     */
+    virtual EShape getShape() const { return EGeneric; }
+
     /**
      * \brief Return the type of object (i.e. Mesh/Camera/etc.) 
      * provided by this instance
@@ -54,4 +73,43 @@ protected:
     float m_radius;
 };
 
+/**
+ * \brief Importance sampling of a reconstruction filter
+ *
+ * Instead of splatting every sample into all pixels within the filter
+ * radius, filter importance sampling distributes the pixel samples
+ * according to the filter and adds each of them to a single pixel.
+ * This class tabulates the absolute value of the (separable) filter
+ * and samples offsets from the pixel center proportional to it. The
+ * returned weights are the ratio of the filter and the sampling density
+ * (normalized to have a magnitude of about one), which accounts for the
+ * tabulation and for negative filter lobes.
+ */
+class FilterSampler {
+public:
+    /// Tabulate the given filter
+    FilterSampler(const ReconstructionFilter *filter);
+
+    /**
+     * \brief Sample an offset from the pixel center
+     *
+     * \param sample
+     *     A uniformly distributed sample on <tt>[0,1]^2</tt>
+     * \param offset
+     *     The sampled offset (in pixels)
+     * \return
+     *     The weight of the sample
+     */
+    float sample(const Point2f &sample, Vector2f &offset) const;
+
+protected:
+    /// Sample an offset along one axis and return its weight
+    float sample1D(float sample, float &offset) const;
+
+private:
+    const ReconstructionFilter *m_filter;
+    DiscretePDF m_pdf;
+    float m_radius;
+};
+
 NORI_NAMESPACE_END
@@ -74,16 +74,31 @@ public:
      * a new image block. This can be used to deterministically
      * initialize the sampler so that repeated program runs
      * always create the same image.
+     *
+     * \param block
+     *    The image block that is about to be rendered
+     * \param pass
+     *    Index of the current pass when rendering progressively.
+     *    Samples generated in different passes should be
+     *    decorrelated. Pass 0 must produce the same samples
+     *    as a non-progressive render.
      */
-    virtual void prepare(const ImageBlock &block) = 0;
+    virtual void prepare(const ImageBlock &block, uint32_t pass = 0) = 0;
 
     /**
      * \brief Prepare to generate new samples
      * 
      * This function is called initially and every time the 
      * integrator starts rendering a new pixel.
+     *
+     * \param pixel
+     *    Integer coordinates of the pixel
+     * \param sampleIndex
+     *    Index of the first sample within the pixel (i.e. the number of
+     *    samples taken by previous passes). Samplers based on sample
+     *    sequences continue the sequence of the pixel from here.
      */
-    virtual void generate() = 0;
+    virtual void generate(const Point2i &pixel, uint32_t sampleIndex = 0) = 0;
 
     /// Advance to the next sample
     virtual void advance() = 0;
@@ -94,15 +109,53 @@ public:
     /// Retrieve the next two component values from the current sample
     virtual Point2f next2D() = 0;
 
+    /**
+     * \brief Generate the leading 2D components of several pixel samples
+     *
+     * Fills \c result with the first \c dimensions 2D components of the
+     * next \c count samples of the current pixel (stored sample by sample),
+     * as if \ref next2D() had been called \c dimensions times for each of
+     * them. While rendering these samples, \ref next1D() and \ref next2D()
+     * then continue with the subsequent components. Must be called right
+     * after \ref generate().
+     *
+     * This allows generating e.g. all camera samples of a pixel in bulk
+     * (and vectorized), without a virtual call per value.
+     *
+     * The default implementation calls \ref next2D() and \ref advance()
+     * for each sample and then returns to the first one with \ref rewind().
+     */
+    virtual void generateBatch(uint32_t count, uint32_t dimensions, Point2f *result) {
+        for (uint32_t i = 0; i < count; ++i) {
+            for (uint32_t j = 0; j < dimensions; ++j)
+                *result++ = next2D();
+            advance();
+        }
+        rewind(count, dimensions);
+    }
+
     /// Return the number of configured pixel samples
     virtual size_t getSampleCount() const { return m_sampleCount; }
 
+    /// Change the number of pixel samples (e.g. from a command line override)
+    virtual void setSampleCount(size_t sampleCount) { m_sampleCount = sampleCount; }
+
     /**
      * \brief Return the type of object (i.e. Mesh/Sampler/etc.) 
      * provided by this instance
      * */
     EClassType getClassType() const { return ESampler; }
 protected:
+    /**
+     * \brief Go back \c count samples and let them (and all subsequent
+     * samples of the pixel) start with the 2D component \c dimension
+     *
+     * Used by the default \ref generateBatch(). Samplers whose values
+     * depend on the sample index must implement it; the default does
+     * nothing, which suits samplers that draw from a random stream.
+     */
+    virtual void rewind(uint32_t /* count */, uint32_t /* dimension */) { }
+
     size_t m_sampleCount;
 };
 
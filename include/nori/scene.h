@@ -46,8 +46,23 @@ public:
     /// Return a pointer to the scene's integrator
     Integrator *getIntegrator() { return m_integrator; }
 
-    /// Return a pointer to the scene's camera
-    const Camera *getCamera() const { return m_camera; }
+    /// Return a pointer to the active camera (const version)
+    const Camera *getCamera() const { return m_cameras[m_activeCamera]; }
+
+    /// Return a pointer to the active camera
+    Camera *getCamera() { return m_cameras[m_activeCamera]; }
+
+    /**
+     * \brief Return the number of cameras
+     *
+     * A scene may declare several cameras (e.g. the views of a stereo
+     * pair or the frames of a turntable), which are rendered one after
+     * the other.
+     */
+    size_t getCameraCount() const { return m_cameras.size(); }
+
+    /// Select the camera returned by \ref getCamera()
+    void setActiveCamera(size_t index);
 
     /// Return a pointer to the scene's sample generator (const version)
     const Sampler *getSampler() const { return m_sampler; }
@@ -120,7 +135,8 @@ private:
     std::vector<Mesh *> m_meshes;
     Integrator *m_integrator = nullptr;
     Sampler *m_sampler = nullptr;
-    Camera *m_camera = nullptr;
+    std::vector<Camera *> m_cameras;
+    size_t m_activeCamera = 0;
     Accel *m_accel = nullptr;
 };
 
@@ -0,0 +1,144 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/common.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Eight interleaved xoshiro128+ pseudorandom number generators
+ *
+ * Generates random numbers in batches of eight, one per lane. The
+ * generator only needs 32-bit additions, shifts and XORs, which map
+ * directly onto AVX2 instructions when Nori is compiled with AVX2
+ * support (e.g. <tt>-mavx2</tt>). Otherwise, the lanes are processed by
+ * simple loops, which compilers vectorize with SSE2.
+ *
+ * xoshiro128+ (Blackman and Vigna) has weak low-order bits, so only the
+ * upper 23 bits are used to produce floating point values.
+ */
+class Xoshiro8 {
+public:
+    /// Create a generator with a default seed
+    Xoshiro8() { seed(0, 0); }
+
+    /// Seed the eight lanes from a 64-bit seed and stream index
+    void seed(uint64_t seed, uint64_t stream) {
+        uint64_t x = seed ^ (stream * 0xda942042e4dd58b5ull);
+        for (int i = 0; i < 4; ++i) {
+            for (int lane = 0; lane < 8; lane += 2) {
+                uint64_t value = splitMix64(x);
+                m_state[i][lane] = (uint32_t) value;
+                m_state[i][lane + 1] = (uint32_t) (value >> 32);
+            }
+        }
+        /* The all-zero state of a lane is a fixed point */
+        for (int lane = 0; lane < 8; ++lane) {
+            if ((m_state[0][lane] | m_state[1][lane] | m_state[2][lane] | m_state[3][lane]) == 0)
+                m_state[0][lane] = 1;
+        }
+    }
+
+    /**
+     * \brief Fill an array with uniformly distributed floating point
+     * values on <tt>[0, 1)</tt>
+     *
+     * Values are generated eight at a time, so the lanes advance by
+     * <tt>ceil(count / 8)</tt> steps.
+     */
+    void nextFloat(float *result, size_t count) {
+#if defined(__AVX2__)
+        __m256i s0 = _mm256_loadu_si256((const __m256i *) m_state[0]),
+                s1 = _mm256_loadu_si256((const __m256i *) m_state[1]),
+                s2 = _mm256_loadu_si256((const __m256i *) m_state[2]),
+                s3 = _mm256_loadu_si256((const __m256i *) m_state[3]);
+        const __m256i one = _mm256_set1_epi32(0x3f800000);
+
+        for (size_t i = 0; i < count; i += 8) {
+            __m256i value = _mm256_add_epi32(s0, s3), t = _mm256_slli_epi32(s1, 9);
+            s2 = _mm256_xor_si256(s2, s0);
+            s3 = _mm256_xor_si256(s3, s1);
+            s1 = _mm256_xor_si256(s1, s2);
+            s0 = _mm256_xor_si256(s0, s3);
+            s2 = _mm256_xor_si256(s2, t);
+            s3 = _mm256_or_si256(_mm256_slli_epi32(s3, 11), _mm256_srli_epi32(s3, 21));
+
+            __m256 f = _mm256_sub_ps(_mm256_castsi256_ps(_mm256_or_si256(
+                _mm256_srli_epi32(value, 9), one)), _mm256_set1_ps(1.0f));
+            if (i + 8 <= count) {
+                _mm256_storeu_ps(result + i, f);
+            } else {
+                alignas(32) float tmp[8];
+                _mm256_store_ps(tmp, f);
+                for (size_t j = i; j < count; ++j)
+                    result[j] = tmp[j - i];
+            }
+        }
+
+        _mm256_storeu_si256((__m256i *) m_state[0], s0);
+        _mm256_storeu_si256((__m256i *) m_state[1], s1);
+        _mm256_storeu_si256((__m256i *) m_state[2], s2);
+        _mm256_storeu_si256((__m256i *) m_state[3], s3);
+#else
+        for (size_t i = 0; i < count; i += 8) {
+            alignas(32) uint32_t value[8];
+            nextUInt(value);
+            size_t n = std::min(count - i, (size_t) 8);
+            for (size_t j = 0; j < n; ++j) {
+                union { uint32_t u; float f; } x;
+                x.u = (value[j] >> 9) | 0x3f800000u;
+                result[i + j] = x.f - 1.0f;
+            }
+        }
+#endif
+    }
+
+    /// Generate one 32-bit value per lane
+    void nextUInt(uint32_t result[8]) {
+        uint32_t (&s)[4][8] = m_state;
+        for (int lane = 0; lane < 8; ++lane) {
+            result[lane] = s[0][lane] + s[3][lane];
+            uint32_t t = s[1][lane] << 9;
+            s[2][lane] ^= s[0][lane];
+            s[3][lane] ^= s[1][lane];
+            s[1][lane] ^= s[2][lane];
+            s[0][lane] ^= s[3][lane];
+            s[2][lane] ^= t;
+            s[3][lane] = (s[3][lane] << 11) | (s[3][lane] >> 21);
+        }
+    }
+
+protected:
+    static uint64_t splitMix64(uint64_t &x) {
+        uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+private:
+    uint32_t m_state[4][8];
+};
+
+NORI_NAMESPACE_END
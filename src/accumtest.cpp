@@ -0,0 +1,233 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/block.h>
+#include <nori/rfilter.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <pcg32.h>
+#include <algorithm>
+#include <cstring>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Test of the deterministic block accumulation
+ *
+ * Splats random samples into the cells of a \ref BlockScheduler and
+ * merges them with a \ref BlockAccumulator in different orders (scanline,
+ * reversed, and shuffled on several threads). The resulting images must
+ * be bitwise identical, and they must match the images obtained by
+ * merging the same cells with \ref ImageBlock::put() up to rounding.
+ *
+ * It also renders the tiles of 2 and 3 partitions separately (like the
+ * processes of a distributed render with <tt>--tiles i/N</tt>) and checks
+ * that the sum of the partial images matches the full image.
+ */
+class AccumulatorTest : public NoriObject {
+public:
+    AccumulatorTest(const PropertyList &propList) {
+        /* Size of the test image (not a multiple of the cell size by default) */
+        m_width = propList.getInteger("width", 237);
+        m_height = propList.getInteger("height", 173);
+
+        /* Number of samples per pixel */
+        m_sampleCount = propList.getInteger("sampleCount", 4);
+
+        /* Maximum relative deviation from ImageBlock::put() */
+        m_tolerance = propList.getFloat("tolerance", 1e-4f);
+    }
+
+    virtual ~AccumulatorTest() {
+        for (auto filter : m_filters)
+            delete filter;
+    }
+
+    void addChild(NoriObject *obj) {
+        switch (obj->getClassType()) {
+            case EReconstructionFilter:
+                m_filters.push_back(static_cast<ReconstructionFilter *>(obj));
+                break;
+
+            default:
+                throw NoriException("AccumulatorTest::addChild(<%s>) is not supported!",
+                    classTypeName(obj->getClassType()));
+        }
+    }
+
+    void activate() {
+        int total = 0, passed = 0;
+        const Vector2i size(m_width, m_height);
+        BlockScheduler scheduler(size, NORI_BLOCK_SIZE);
+        int cellSize = scheduler.getCellSize();
+        Vector2i numCells((m_width + cellSize - 1) / cellSize,
+                          (m_height + cellSize - 1) / cellSize);
+
+        std::vector<Point2i> scanline;
+        for (int y=0; y<numCells.y(); ++y)
+            for (int x=0; x<numCells.x(); ++x)
+                scanline.push_back(Point2i(x, y));
+        std::vector<Point2i> reversed(scanline.rbegin(), scanline.rend());
+        std::vector<Point2i> shuffled = scanline;
+        pcg32 random;
+        for (size_t i=shuffled.size()-1; i>0; --i)
+            std::swap(shuffled[i], shuffled[random.nextUInt((uint32_t) i + 1)]);
+
+        for (auto filter : m_filters) {
+            cout << "------------------------------------------------------" << endl;
+            cout << "Testing: " << filter->toString() << endl;
+
+            /* Accumulate the cells in three different orders */
+            ImageBlock reference(size, filter), image(size, filter);
+            accumulate(scheduler, filter, scanline, false, reference);
+
+            const char *names[] = { "reversed", "shuffled (parallel)" };
+            for (int i=0; i<2; ++i) {
+                ++total;
+                accumulate(scheduler, filter, i == 0 ? reversed : shuffled, i == 1, image);
+                bool identical = image.size() == reference.size() &&
+                    memcmp(image.data(), reference.data(), sizeof(Color4f) * image.size()) == 0;
+                cout << "Scanline vs " << names[i] << " order: "
+                     << (identical ? "bitwise identical" : "different") << endl;
+                if (identical)
+                    ++passed;
+            }
+
+            /* Compare against the locked ImageBlock::put() */
+            ++total;
+            image.clear();
+            ImageBlock block(Vector2i(cellSize), filter);
+            for (const Point2i &cell : scanline) {
+                render(scheduler, cell, block);
+                image.put(block);
+            }
+            float maxError = 0, maxValue = 0;
+            for (int y=0; y<image.rows(); ++y) {
+                for (int x=0; x<image.cols(); ++x) {
+                    maxError = std::max(maxError, (image.coeff(y, x) - reference.coeff(y, x)).abs().maxCoeff());
+                    maxValue = std::max(maxValue, reference.coeff(y, x).abs().maxCoeff());
+                }
+            }
+            cout << tfm::format("Maximum deviation from ImageBlock::put(): %e (relative: %e)",
+                maxError, maxError / maxValue) << endl;
+            if (maxError <= m_tolerance * maxValue)
+                ++passed;
+
+            /* Sum the partial images of distributed renders */
+            for (int count=2; count<=3; ++count) {
+                ++total;
+                image.clear();
+                for (int index=0; index<count; ++index) {
+                    BlockScheduler partition(size, NORI_BLOCK_SIZE);
+                    partition.setPartition(index, count);
+                    std::vector<bool> scheduled;
+                    partition.markScheduledCells(scheduled);
+
+                    std::vector<Point2i> cells;
+                    BoundingBox2i range;
+                    partition.reset(false, 1);
+                    while (partition.next(range))
+                        for (int y=range.min.y(); y<=range.max.y(); ++y)
+                            for (int x=range.min.x(); x<=range.max.x(); ++x)
+                                cells.push_back(Point2i(x, y));
+
+                    ImageBlock partial(size, filter);
+                    accumulate(scheduler, filter, cells, true, partial, &scheduled);
+                    image.put(partial);
+                }
+                float maxError = 0;
+                for (int y=0; y<image.rows(); ++y)
+                    for (int x=0; x<image.cols(); ++x)
+                        maxError = std::max(maxError, (image.coeff(y, x) - reference.coeff(y, x)).abs().maxCoeff());
+                cout << tfm::format("Maximum deviation of %i merged partitions: %e (relative: %e)",
+                    count, maxError, maxError / maxValue) << endl;
+                if (maxError <= m_tolerance * maxValue)
+                    ++passed;
+            }
+        }
+
+        cout << "Passed " << passed << "/" << total << " tests." << endl;
+        if (passed < total)
+            throw std::runtime_error("Some tests failed :(");
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "AccumulatorTest[\n"
+            "  width = %i,\n"
+            "  height = %i,\n"
+            "  sampleCount = %i,\n"
+            "  tolerance = %f\n"
+            "]",
+            m_width,
+            m_height,
+            m_sampleCount,
+            m_tolerance
+        );
+    }
+
+    EClassType getClassType() const { return ETest; }
+
+protected:
+    /// Splat random samples into a cell (they only depend on the cell)
+    void render(const BlockScheduler &scheduler, const Point2i &cell, ImageBlock &block) const {
+        scheduler.configure(cell, block);
+        block.clear();
+        pcg32 random;
+        random.seed((uint64_t) cell.y() * m_width + cell.x(), 0x1234);
+        Vector2i size = block.getSize();
+        Point2f offset = block.getOffset().cast<float>();
+        for (int i=0, n=size.x()*size.y()*m_sampleCount; i<n; ++i) {
+            Point2f p = offset + Vector2f(random.nextFloat() * size.x(), random.nextFloat() * size.y());
+            block.put(p, Color3f(random.nextFloat(), random.nextFloat(), random.nextFloat()) * 10.0f);
+        }
+    }
+
+    /// Merge the given cells with a BlockAccumulator in this order
+    void accumulate(const BlockScheduler &scheduler, const ReconstructionFilter *filter,
+                    const std::vector<Point2i> &order, bool parallel, ImageBlock &image,
+                    const std::vector<bool> *scheduled = nullptr) const {
+        image.clear();
+        BlockAccumulator accumulator(image, scheduler.getCellSize());
+        if (scheduled) {
+            accumulator.setScheduled(*scheduled);
+            accumulator.reset();
+        }
+        auto body = [&](const tbb::blocked_range<size_t> &range) {
+            ImageBlock block(Vector2i(scheduler.getCellSize()), filter);
+            for (size_t i=range.begin(); i<range.end(); ++i) {
+                render(scheduler, order[i], block);
+                accumulator.put(block);
+            }
+        };
+        if (parallel)
+            tbb::parallel_for(tbb::blocked_range<size_t>(0, order.size(), 1), body);
+        else
+            body(tbb::blocked_range<size_t>(0, order.size()));
+    }
+
+private:
+    std::vector<ReconstructionFilter *> m_filters;
+    int m_width;
+    int m_height;
+    int m_sampleCount;
+    float m_tolerance;
+};
+
+NORI_REGISTER_CLASS(AccumulatorTest, "accumtest");
+NORI_NAMESPACE_END
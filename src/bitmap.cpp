@@ -19,13 +19,25 @@
 #include <nori/bitmap.h>
 #include <ImfInputFile.h>
 #include <ImfOutputFile.h>
+#include <ImfTiledOutputFile.h>
 #include <ImfChannelList.h>
 #include <ImfStringAttribute.h>
+#include <ImfCompression.h>
+#include <ImfCompressor.h>
+#include <ImfThreading.h>
 #include <ImfVersion.h>
 #include <ImfIO.h>
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image_write.h>
+#include <nori/timer.h>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <exception>
 
 NORI_NAMESPACE_BEGIN
 
@@ -78,19 +90,62 @@ Bitmap::Bitmap(const std::string &filename) {
     file.readPixels(dw.min.y, dw.max.y);
 }
 
-void Bitmap::saveEXR(const std::string &filename) {
-    cout << "Writing a " << cols() << "x" << rows()
-         << " OpenEXR file to \"" << filename << "\"" << endl;
-
-    std::string path = filename + ".exr";
+/// Create the header of an OpenEXR file with the given size and settings
+static Imf::Header createHeader(const Vector2i &size, const EXROptions &options) {
+    Imf::Compression compression;
+    switch (options.compression) {
+        case EXROptions::ENone: compression = Imf::NO_COMPRESSION; break;
+        case EXROptions::EPIZ: compression = Imf::PIZ_COMPRESSION; break;
+        case EXROptions::EDWAA: compression = Imf::DWAA_COMPRESSION; break;
+        default: compression = Imf::ZIP_COMPRESSION; break;
+    }
 
-    Imf::Header header((int) cols(), (int) rows());
+    Imf::Header header(size.x(), size.y());
     header.insert("comments", Imf::StringAttribute("Generated by Nori"));
+    header.compression() = compression;
 
+    /* OpenEXR converts the values when the channels are stored as halfs */
+    Imf::PixelType type = options.half ? Imf::HALF : Imf::FLOAT;
     Imf::ChannelList &channels = header.channels();
-    channels.insert("R", Imf::Channel(Imf::FLOAT));
-    channels.insert("G", Imf::Channel(Imf::FLOAT));
-    channels.insert("B", Imf::Channel(Imf::FLOAT));
+    channels.insert("R", Imf::Channel(type));
+    channels.insert("G", Imf::Channel(type));
+    channels.insert("B", Imf::Channel(type));
+    return header;
+}
+
+/// Print the size of a written file along with a description
+static void reportFile(const std::string &path, const std::string &description, const Timer &timer) {
+    std::ifstream is(path, std::ios::binary | std::ios::ate);
+    cout << "Wrote " << description << " to \"" << path << "\" (took "
+         << timer.elapsedString() << ", " << memString((size_t) is.tellg()) << ")" << endl;
+}
+
+/// Describe the format of an OpenEXR file
+static std::string formatString(const Vector2i &size, const EXROptions &options) {
+    static const char *compressionNames[] = { "no", "ZIP", "PIZ", "DWAA" };
+    return tfm::format("%ix%i OpenEXR file (%s, %s compression)", size.x(), size.y(),
+                       options.half ? "half" : "float", compressionNames[options.compression]);
+}
+
+/// Size OpenEXR's global thread pool as requested and return the number of threads
+static int setThreadCount(const EXROptions &options) {
+    int threadCount = options.threadCount >= 0 ? options.threadCount
+        : (int) std::thread::hardware_concurrency();
+    if (Imf::globalThreadCount() != threadCount)
+        Imf::setGlobalThreadCount(threadCount);
+    return threadCount;
+}
+
+void Bitmap::saveEXR(const std::string &filename, const EXROptions &options) {
+    Timer timer;
+
+    std::string path = filename + ".exr";
+
+    /* Compress in parallel using OpenEXR's global thread pool */
+    int threadCount = setThreadCount(options);
+
+    Imf::Header header = createHeader(Vector2i((int) cols(), (int) rows()), options);
+    Imf::Compression compression = header.compression();
 
     Imf::FrameBuffer frameBuffer;
     size_t compStride = sizeof(float),
@@ -102,9 +157,32 @@ void Bitmap::saveEXR(const std::string &filename) {
     frameBuffer.insert("G", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
     frameBuffer.insert("B", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride));
 
-    Imf::OutputFile file(path.c_str(), header);
-    file.setFrameBuffer(frameBuffer);
-    file.writePixels((int) rows());
+    {
+        Imf::OutputFile file(path.c_str(), header, threadCount);
+        file.setFrameBuffer(frameBuffer);
+
+        /* Write chunks of one block of scanlines (as compressed together)
+           per thread, so that all threads have work in every call */
+        int chunkSize = Imf::numLinesInBuffer(compression) * std::max(threadCount, 1);
+        for (int y = 0; y < (int) rows(); y += chunkSize)
+            file.writePixels(std::min(chunkSize, (int) rows() - y));
+    }
+
+    /* Report in a single line, as files may be written in the background */
+    reportFile(path, "a " + formatString(Vector2i((int) cols(), (int) rows()), options), timer);
+}
+
+EXROptions::ECompression EXROptions::parseCompression(const std::string &name) {
+    std::string value = toLower(name);
+    if (value == "none")
+        return ENone;
+    else if (value == "zip")
+        return EZIP;
+    else if (value == "piz")
+        return EPIZ;
+    else if (value == "dwaa")
+        return EDWAA;
+    throw NoriException("Unknown EXR compression \"%s\" (expected none, zip, piz or dwaa)!", name);
 }
 
 void Bitmap::savePNG(const std::string &filename) {
@@ -133,4 +211,189 @@ void Bitmap::savePNG(const std::string &filename) {
     delete[] rgb8;
 }
 
+struct TiledEXRWriter::File {
+    Imf::TiledOutputFile file;
+    std::string description;
+    Timer timer;
+
+    std::mutex mutex;
+    std::condition_variable cond;                ///< Signals tiles to write (or stopping)
+    std::condition_variable space;               ///< Signals that the queue was emptied
+    std::vector<std::unique_ptr<Bitmap>> tiles;  ///< Tiles that are being filled
+    std::vector<int> missing;                    ///< Number of pixels not yet added to each tile
+    std::deque<int> queue;                       ///< Complete tiles waiting to be written
+    size_t maxQueued;                            ///< Number of queued tiles at which put() waits
+    std::exception_ptr error;
+    bool stop = false;
+    std::thread thread;
+
+    File(const std::string &path, const Imf::Header &header, int threadCount)
+        : file(path.c_str(), header, threadCount),
+          maxQueued((size_t) NORI_EXR_QUEUED_TILES * std::max(threadCount, 1)) { }
+
+    /// Write the remaining complete tiles and stop the thread
+    void join() {
+        if (!thread.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            stop = true;
+        }
+        cond.notify_all();
+        thread.join();
+    }
+};
+
+TiledEXRWriter::TiledEXRWriter(const std::string &filename, const Vector2i &size,
+                               const EXROptions &options)
+    : m_filename(filename + ".exr"), m_size(size) {
+    Imf::Header header = createHeader(size, options);
+    header.setTileDescription(Imf::TileDescription(NORI_EXR_TILE_SIZE, NORI_EXR_TILE_SIZE, Imf::ONE_LEVEL));
+    header.lineOrder() = Imf::RANDOM_Y;
+    m_file.reset(new File(m_filename, header, setThreadCount(options)));
+    m_file->description = "a tiled " + formatString(size, options);
+
+    m_numTiles = Vector2i(
+        (size.x() + NORI_EXR_TILE_SIZE - 1) / NORI_EXR_TILE_SIZE,
+        (size.y() + NORI_EXR_TILE_SIZE - 1) / NORI_EXR_TILE_SIZE
+    );
+    m_file->tiles.resize(m_numTiles.x() * m_numTiles.y());
+    for (int y=0; y<m_numTiles.y(); ++y) {
+        for (int x=0; x<m_numTiles.x(); ++x) {
+            m_file->missing.push_back(
+                std::min(NORI_EXR_TILE_SIZE, size.x() - x * NORI_EXR_TILE_SIZE) *
+                std::min(NORI_EXR_TILE_SIZE, size.y() - y * NORI_EXR_TILE_SIZE));
+        }
+    }
+    m_file->thread = std::thread([this] { run(); });
+}
+
+TiledEXRWriter::~TiledEXRWriter() {
+    if (m_file)
+        m_file->join();
+}
+
+void TiledEXRWriter::put(const Point2i &offset, const Bitmap &pixels) {
+    Point2i end = offset + Vector2i((int) pixels.cols(), (int) pixels.rows());
+    bool notify = false;
+
+    /* Bound the memory held by tiles that wait for the writing thread */
+    std::unique_lock<std::mutex> lock(m_file->mutex);
+    m_file->space.wait(lock, [&] { return m_file->queue.size() < m_file->maxQueued; });
+
+    for (int ty=offset.y() / NORI_EXR_TILE_SIZE; ty * NORI_EXR_TILE_SIZE < end.y(); ++ty) {
+        for (int tx=offset.x() / NORI_EXR_TILE_SIZE; tx * NORI_EXR_TILE_SIZE < end.x(); ++tx) {
+            /* Copy the part of the pixels that overlaps this tile */
+            Point2i tileOffset(tx * NORI_EXR_TILE_SIZE, ty * NORI_EXR_TILE_SIZE);
+            Point2i from = offset.cwiseMax(tileOffset),
+                    to = end.cwiseMin(tileOffset + Vector2i::Constant(NORI_EXR_TILE_SIZE));
+            Vector2i size = to - from;
+
+            int index = ty * m_numTiles.x() + tx;
+            std::unique_ptr<Bitmap> &tile = m_file->tiles[index];
+            if (!tile)
+                tile.reset(new Bitmap(m_size.cwiseMin(tileOffset + Vector2i::Constant(NORI_EXR_TILE_SIZE)) - tileOffset));
+            tile->block(from.y() - tileOffset.y(), from.x() - tileOffset.x(), size.y(), size.x()) =
+                pixels.block(from.y() - offset.y(), from.x() - offset.x(), size.y(), size.x());
+
+            /* Hand complete tiles over to the writing thread */
+            m_file->missing[index] -= size.x() * size.y();
+            if (m_file->missing[index] == 0) {
+                m_file->queue.push_back(index);
+                notify = true;
+            }
+        }
+    }
+    lock.unlock();
+    if (notify)
+        m_file->cond.notify_one();
+}
+
+void TiledEXRWriter::run() {
+    std::unique_lock<std::mutex> lock(m_file->mutex);
+    while (true) {
+        m_file->cond.wait(lock, [&] { return m_file->stop || !m_file->queue.empty(); });
+        if (m_file->queue.empty())
+            break;
+
+        /* Take all queued tiles, sorted in scanline order */
+        std::map<int, std::unique_ptr<Bitmap>> batch;
+        for (int index : m_file->queue)
+            batch[index] = std::move(m_file->tiles[index]);
+        m_file->queue.clear();
+        lock.unlock();
+        m_file->space.notify_all();
+
+        /* Compress and write the tiles without holding the lock */
+        try {
+            while (!batch.empty()) {
+                /* Grow a rectangle of taken tiles from the first one: to the right
+                   as far as possible, then down while whole rows are available */
+                int first = batch.begin()->first;
+                Point2i min(first % m_numTiles.x(), first / m_numTiles.x()), max = min;
+                while (max.x() + 1 < m_numTiles.x() && batch.count(max.y() * m_numTiles.x() + max.x() + 1))
+                    ++max.x();
+                while (max.y() + 1 < m_numTiles.y()) {
+                    bool complete = true;
+                    for (int tx=min.x(); tx<=max.x() && complete; ++tx)
+                        complete = batch.count((max.y() + 1) * m_numTiles.x() + tx) != 0;
+                    if (!complete)
+                        break;
+                    ++max.y();
+                }
+
+                /* Copy the tiles into one bitmap covering the rectangle */
+                Point2i offset = min * NORI_EXR_TILE_SIZE;
+                Vector2i size = m_size.cwiseMin((max + Vector2i::Constant(1)) * NORI_EXR_TILE_SIZE) - offset;
+                Bitmap pixels(size);
+                for (int ty=min.y(); ty<=max.y(); ++ty) {
+                    for (int tx=min.x(); tx<=max.x(); ++tx) {
+                        auto it = batch.find(ty * m_numTiles.x() + tx);
+                        const Bitmap &tile = *it->second;
+                        pixels.block(ty * NORI_EXR_TILE_SIZE - offset.y(), tx * NORI_EXR_TILE_SIZE - offset.x(),
+                                     tile.rows(), tile.cols()) = tile;
+                        batch.erase(it);
+                    }
+                }
+
+                size_t compStride = sizeof(float),
+                       pixelStride = 3 * compStride,
+                       rowStride = pixelStride * pixels.cols();
+
+                /* Offset the slices so that the rectangle's pixels map onto the bitmap */
+                char *ptr = reinterpret_cast<char *>(pixels.data())
+                    - offset.x() * pixelStride - offset.y() * rowStride;
+
+                Imf::FrameBuffer frameBuffer;
+                frameBuffer.insert("R", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
+                frameBuffer.insert("G", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
+                frameBuffer.insert("B", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride));
+                m_file->file.setFrameBuffer(frameBuffer);
+
+                /* OpenEXR compresses the tiles of the rectangle in parallel */
+                m_file->file.writeTiles(min.x(), max.x(), min.y(), max.y());
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(m_file->mutex);
+            if (!m_file->error)
+                m_file->error = std::current_exception();
+        }
+        batch.clear();
+        lock.lock();
+    }
+}
+
+void TiledEXRWriter::close() {
+    if (!m_file)
+        return;
+    m_file->join();
+    Timer timer = m_file->timer;
+    std::string description = m_file->description;
+    std::exception_ptr error = m_file->error;
+    m_file.reset();
+    if (error)
+        std::rethrow_exception(error);
+    reportFile(m_filename, description, timer);
+}
+
 NORI_NAMESPACE_END
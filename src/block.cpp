@@ -29,6 +29,7 @@ ImageBlock::ImageBlock(const Vector2i &size, const ReconstructionFilter *filter)
     if (filter) {
         /* Tabulate the image reconstruction filter for performance reasons */
         m_filterRadius = filter->getRadius();
+        m_filterShape = filter->getShape();
         m_borderSize = (int) std::ceil(m_filterRadius - 0.5f);
         m_filter = new float[NORI_FILTER_RESOLUTION + 1];
         for (int i=0; i<NORI_FILTER_RESOLUTION; ++i) {
@@ -46,6 +47,9 @@ ImageBlock::ImageBlock(const Vector2i &size, const ReconstructionFilter *filter)
 
     /* Allocate space for pixels and border regions */
     resize(size.y() + 2*m_borderSize, size.x() + 2*m_borderSize);
+
+    m_stripeCount = std::max(1, (size.y() + NORI_BLOCK_SIZE - 1) / NORI_BLOCK_SIZE);
+    m_stripeMutexes.reset(new tbb::mutex[m_stripeCount]);
 }
 
 ImageBlock::~ImageBlock() {
@@ -62,6 +66,74 @@ Bitmap *ImageBlock::toBitmap() const {
     return result;
 }
 
+Bitmap *ImageBlock::toVarianceBitmap() const {
+    if (!hasMoments())
+        throw NoriException("ImageBlock::toVarianceBitmap(): moments were not recorded!");
+    Bitmap *result = new Bitmap(m_size);
+    for (int y=0; y<m_size.y(); ++y)
+        for (int x=0; x<m_size.x(); ++x)
+            result->coeffRef(y, x) = Color3f(getMoments(x, y).getVarianceOfMean());
+    return result;
+}
+
+void ImageBlock::clear() {
+    setConstant(Color4f());
+    std::fill(m_moments.begin(), m_moments.end(), PixelMoments());
+}
+
+void ImageBlock::setMomentsEnabled(bool enabled) {
+    if (enabled) {
+        m_momentsStride = (int) cols() - 2*m_borderSize;
+        m_moments.assign((size_t) m_momentsStride * (rows() - 2*m_borderSize), PixelMoments());
+    } else {
+        m_momentsStride = 0;
+        m_moments.clear();
+    }
+}
+
+void ImageBlock::save(std::ostream &os) const {
+    int32_t header[6] = { m_offset.x(), m_offset.y(), m_size.x(), m_size.y(),
+                          m_borderSize, hasMoments() ? 1 : 0 };
+    os.write("NBLK", 4);
+    os.write(reinterpret_cast<const char *>(header), sizeof(header));
+    os.write(reinterpret_cast<const char *>(data()), sizeof(Color4f) * size());
+    if (hasMoments()) {
+        for (int y=0; y<m_size.y(); ++y)
+            os.write(reinterpret_cast<const char *>(&getMoments(0, y)),
+                     sizeof(PixelMoments) * m_size.x());
+    }
+}
+
+void ImageBlock::load(std::istream &is) {
+    char magic[4];
+    int32_t header[6];
+    is.read(magic, 4);
+    is.read(reinterpret_cast<char *>(header), sizeof(header));
+    if (is.fail() || memcmp(magic, "NBLK", 4) != 0)
+        throw NoriException("ImageBlock::load(): invalid data!");
+    if (m_filter && header[4] != m_borderSize)
+        throw NoriException("ImageBlock::load(): border size mismatch (%i vs %i)!",
+                            header[4], m_borderSize);
+
+    m_offset = Point2i(header[0], header[1]);
+    m_size = Vector2i(header[2], header[3]);
+    m_borderSize = header[4];
+    resize(m_size.y() + 2*m_borderSize, m_size.x() + 2*m_borderSize);
+    m_stripeCount = std::max(1, (m_size.y() + NORI_BLOCK_SIZE - 1) / NORI_BLOCK_SIZE);
+    m_stripeMutexes.reset(new tbb::mutex[m_stripeCount]);
+    is.read(reinterpret_cast<char *>(data()), sizeof(Color4f) * size());
+
+    setMomentsEnabled(header[5] != 0);
+    if (hasMoments()) {
+        for (int y=0; y<m_size.y(); ++y)
+            is.read(reinterpret_cast<char *>(&getMoments(0, y)),
+                    sizeof(PixelMoments) * m_size.x());
+    }
+
+    if (is.fail())
+        throw NoriException("ImageBlock::load(): unexpected end of data!");
+}
+
 void ImageBlock::fromBitmap(const Bitmap &bitmap) {
     if (bitmap.cols() != cols() || bitmap.rows() != rows())
         throw NoriException("Invalid bitmap dimensions!");
@@ -84,24 +156,91 @@ void ImageBlock::put(const Point2f &_pos, const Color3f &value) {
         _pos.y() - 0.5f - (m_offset.y() - m_borderSize)
     );
 
-    /* Compute the rectangle of pixels that will need to be updated */
-    BoundingBox2i bbox(
-        Point2i((int)  std::ceil(pos.x() - m_filterRadius), (int)  std::ceil(pos.y() - m_filterRadius)),
-        Point2i((int) std::floor(pos.x() + m_filterRadius), (int) std::floor(pos.y() + m_filterRadius))
-    );
-    bbox.clip(BoundingBox2i(Point2i(0, 0), Point2i((int) cols() - 1, (int) rows() - 1)));
+    Color4f color(value);
+    int width = (int) cols(), height = (int) rows();
 
-    /* Lookup values from the pre-rasterized filter */
-    for (int x=bbox.min.x(), idx = 0; x<=bbox.max.x(); ++x)
-        m_weightsX[idx++] = m_filter[(int) (std::abs(x-pos.x()) * m_lookupFactor)];
-    for (int y=bbox.min.y(), idx = 0; y<=bbox.max.y(); ++y)
-        m_weightsY[idx++] = m_filter[(int) (std::abs(y-pos.y()) * m_lookupFactor)];
+    if (m_filterShape == ReconstructionFilter::EBox) {
+        /* The box filter only covers the pixel containing the sample */
+        int x = (int) std::floor(pos.x() + 0.5f), y = (int) std::floor(pos.y() + 0.5f);
+        if (x >= 0 && y >= 0 && x < width && y < height)
+            coeffRef(y, x) += color;
+    } else if (m_filterShape == ReconstructionFilter::ETent) {
+        /* The tent filter has bilinear weights on the 2x2 nearest pixels */
+        int x0 = (int) std::floor(pos.x()), y0 = (int) std::floor(pos.y());
+        float fx = pos.x() - x0, fy = pos.y() - y0;
+        float weightsX[2] = { 1.0f - fx, fx }, weightsY[2] = { 1.0f - fy, fy };
+        for (int j=0; j<2; ++j) {
+            int y = y0 + j;
+            if (y < 0 || y >= height)
+                continue;
+            Color4f rowValue = color * weightsY[j];
+            for (int i=0; i<2; ++i) {
+                int x = x0 + i;
+                if (x >= 0 && x < width)
+                    coeffRef(y, x) += rowValue * weightsX[i];
+            }
+        }
+    } else {
+        /* Compute the rectangle of pixels that will need to be updated */
+        BoundingBox2i bbox(
+            Point2i((int)  std::ceil(pos.x() - m_filterRadius), (int)  std::ceil(pos.y() - m_filterRadius)),
+            Point2i((int) std::floor(pos.x() + m_filterRadius), (int) std::floor(pos.y() + m_filterRadius))
+        );
+        bbox.clip(BoundingBox2i(Point2i(0, 0), Point2i(width - 1, height - 1)));
+
+        /* Lookup values from the pre-rasterized filter */
+        for (int x=bbox.min.x(), idx = 0; x<=bbox.max.x(); ++x)
+            m_weightsX[idx++] = m_filter[(int) (std::abs(x-pos.x()) * m_lookupFactor)];
+        for (int y=bbox.min.y(), idx = 0; y<=bbox.max.y(); ++y)
+            m_weightsY[idx++] = m_filter[(int) (std::abs(y-pos.y()) * m_lookupFactor)];
 
-    for (int y=bbox.min.y(), yr=0; y<=bbox.max.y(); ++y, ++yr) 
-        for (int x=bbox.min.x(), xr=0; x<=bbox.max.x(); ++x, ++xr) 
-            coeffRef(y, x) += Color4f(value) * m_weightsX[xr] * m_weightsY[yr];
+        /* The filter is separable: weighting the sample once per row leaves
+           a single multiply-add per pixel, which operates on all four
+           channels at once (Color4f is a 4-wide SIMD vector) */
+        int rowLength = bbox.max.x() - bbox.min.x() + 1;
+        for (int y=bbox.min.y(), yr=0; y<=bbox.max.y(); ++y, ++yr) {
+            Color4f rowValue = color * m_weightsY[yr];
+            Color4f *row = data() + (size_t) y * width + bbox.min.x();
+            for (int xr=0; xr<rowLength; ++xr)
+                row[xr] += rowValue * m_weightsX[xr];
+        }
+    }
+
+    /* Record the luminance moments of the pixel containing the sample */
+    if (hasMoments()) {
+        int x = (int) std::floor(_pos.x()) - m_offset.x(),
+            y = (int) std::floor(_pos.y()) - m_offset.y();
+        if (x >= 0 && y >= 0 && x < m_size.x() && y < m_size.y()) {
+            PixelMoments &m = m_moments[y * m_momentsStride + x];
+            float lum = value.getLuminance();
+            m.sum += lum;
+            m.sumSqr += lum * lum;
+            m.count++;
+        }
+    }
 }
     
+void ImageBlock::putPixel(const Point2i &pixel, const Color3f &value, float weight) {
+    if (!value.isValid()) {
+        /* If this happens, go fix your code instead of removing this warning ;) */
+        cerr << "Integrator: computed an invalid radiance value: " << value.toString() << endl;
+        return;
+    }
+
+    int x = pixel.x() - m_offset.x(), y = pixel.y() - m_offset.y();
+    if (x < 0 || y < 0 || x >= m_size.x() || y >= m_size.y())
+        return;
+    coeffRef(y + m_borderSize, x + m_borderSize) += Color4f(value) * weight;
+
+    if (hasMoments()) {
+        PixelMoments &m = m_moments[y * m_momentsStride + x];
+        float lum = value.getLuminance();
+        m.sum += lum;
+        m.sumSqr += lum * lum;
+        m.count++;
+    }
+}
+
 void ImageBlock::put(ImageBlock &b) {
     Vector2i offset = b.getOffset() - m_offset +
         Vector2i::Constant(m_borderSize - b.getBorderSize());
@@ -111,6 +250,13 @@ void ImageBlock::put(ImageBlock &b) {
 
     block(offset.y(), offset.x(), size.y(), size.x()) 
         += b.topLeftCorner(size.y(), size.x());
+
+    if (hasMoments() && b.hasMoments()) {
+        Vector2i pos = b.getOffset() - m_offset;
+        for (int y=0; y<b.getSize().y(); ++y)
+            for (int x=0; x<b.getSize().x(); ++x)
+                m_moments[(pos.y() + y) * m_momentsStride + pos.x() + x] += b.getMoments(x, y);
+    }
 }
 
 std::string ImageBlock::toString() const {
@@ -118,8 +264,8 @@ std::string ImageBlock::toString() const {
         m_offset.toString(), m_size.toString());
 }
 
-BlockGenerator::BlockGenerator(const Vector2i &size, int blockSize)
-        : m_size(size), m_blockSize(blockSize) {
+BlockGenerator::BlockGenerator(const Vector2i &size, int blockSize, const Point2i &offset)
+        : m_offset(offset), m_size(size), m_blockSize(blockSize) {
     m_numBlocks = Vector2i(
         (int) std::ceil(size.x() / (float) blockSize),
         (int) std::ceil(size.y() / (float) blockSize));
@@ -137,7 +283,7 @@ bool BlockGenerator::next(ImageBlock &block) {
         return false;
 
     Point2i pos = m_block * m_blockSize;
-    block.setOffset(pos);
+    block.setOffset(m_offset + pos);
     block.setSize((m_size - pos).cwiseMin(Vector2i::Constant(m_blockSize)));
 
     if (--m_blocksLeft == 0)
@@ -163,4 +309,326 @@ bool BlockGenerator::next(ImageBlock &block) {
     return true;
 }
 
+BlockScheduler::BlockScheduler(const Vector2i &size, int blockSize, const Point2i &offset)
+        : m_offset(offset), m_size(size), m_blockSize(blockSize), m_cellSize(blockSize / 2) {
+    if (m_cellSize < 1)
+        throw NoriException("BlockScheduler: invalid block size %i!", blockSize);
+    m_numCells = Vector2i(
+        (size.x() + m_cellSize - 1) / m_cellSize,
+        (size.y() + m_cellSize - 1) / m_cellSize);
+    m_costs.resize(m_numCells.x() * m_numCells.y(), 0.0);
+
+    /* Determine the spiral order of the tiles */
+    BlockGenerator generator(size, blockSize);
+    ImageBlock block(Vector2i(blockSize), nullptr);
+    while (generator.next(block))
+        m_spiral.push_back(block.getOffset() / blockSize);
+    m_tiles = m_spiral;
+}
+
+void BlockScheduler::setPartition(int index, int count) {
+    if (count < 1 || index < 0 || index >= count)
+        throw NoriException("BlockScheduler: invalid partition %i/%i!", index, count);
+
+    /* Number the remaining tiles in scanline order. Repeated calls
+       thereby split an existing partition further */
+    int tilesX = (m_size.x() + m_blockSize - 1) / m_blockSize;
+    std::vector<int> scanline;
+    for (const Point2i &tile : m_spiral)
+        scanline.push_back(tile.y() * tilesX + tile.x());
+    std::sort(scanline.begin(), scanline.end());
+
+    /* Keep the tiles of this partition (in spiral order) */
+    std::vector<Point2i> tiles;
+    for (const Point2i &tile : m_spiral) {
+        size_t rank = std::lower_bound(scanline.begin(), scanline.end(),
+            tile.y() * tilesX + tile.x()) - scanline.begin();
+        if (rank % count == (size_t) index)
+            tiles.push_back(tile);
+    }
+    m_spiral = m_tiles = tiles;
+}
+
+uint64_t BlockScheduler::getPixelCount() const {
+    uint64_t count = 0;
+    for (const Point2i &tile : m_spiral) {
+        Vector2i size = (m_size - tile * m_blockSize).cwiseMin(Vector2i::Constant(m_blockSize));
+        count += (uint64_t) size.x() * size.y();
+    }
+    return count;
+}
+
+void BlockScheduler::markScheduledCells(std::vector<bool> &cells) const {
+    cells.resize((size_t) m_numCells.x() * m_numCells.y(), false);
+    for (const Point2i &tile : m_spiral)
+        for (int y=tile.y()*2; y<std::min(tile.y()*2 + 2, m_numCells.y()); ++y)
+            for (int x=tile.x()*2; x<std::min(tile.x()*2 + 2, m_numCells.x()); ++x)
+                cells[y * m_numCells.x() + x] = true;
+}
+
+void BlockScheduler::reset(bool costAware, int workerCount) {
+    m_costAware = costAware;
+    m_workerCount = std::max(workerCount, 1);
+    m_nextTile = 0;
+    m_split.clear();
+    m_tiles = m_spiral;
+
+    if (costAware && m_hasCosts) {
+        /* Dispatch the most expensive tiles first */
+        auto tileCost = [&](const Point2i &tile) {
+            double cost = 0;
+            for (int y=tile.y()*2; y<std::min(tile.y()*2 + 2, m_numCells.y()); ++y)
+                for (int x=tile.x()*2; x<std::min(tile.x()*2 + 2, m_numCells.x()); ++x)
+                    cost += m_costs[y * m_numCells.x() + x];
+            return cost;
+        };
+        std::vector<double> costs(m_tiles.size());
+        std::vector<size_t> order(m_tiles.size());
+        for (size_t i=0; i<m_tiles.size(); ++i) {
+            costs[i] = tileCost(m_tiles[i]);
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(),
+            [&](size_t a, size_t b) { return costs[a] > costs[b]; });
+        for (size_t i=0; i<order.size(); ++i)
+            m_tiles[i] = m_spiral[order[i]];
+    }
+
+    /* Costs measured during this pass can be used by the next one */
+    m_hasCosts = true;
+}
+
+bool BlockScheduler::next(BoundingBox2i &cells) {
+    tbb::mutex::scoped_lock lock(m_mutex);
+
+    if (m_split.empty()) {
+        if (m_nextTile == m_tiles.size())
+            return false;
+
+        Point2i tile = m_tiles[m_nextTile++];
+        Point2i min = tile * 2,
+                max = (min + Vector2i::Constant(1)).cwiseMin(m_numCells - Vector2i::Constant(1));
+
+        /* Hand out the final tiles as individual cells */
+        size_t tilesLeft = m_tiles.size() - m_nextTile + 1;
+        if (!m_costAware || tilesLeft > (size_t) m_workerCount) {
+            cells = BoundingBox2i(min, max);
+            return true;
+        }
+
+        for (int y=max.y(); y>=min.y(); --y)
+            for (int x=max.x(); x>=min.x(); --x)
+                m_split.push_back(Point2i(x, y));
+    }
+
+    Point2i cell = m_split.back();
+    m_split.pop_back();
+    cells = BoundingBox2i(cell, cell);
+    return true;
+}
+
+void BlockScheduler::configure(const Point2i &cell, ImageBlock &block) const {
+    Point2i pos = cell * m_cellSize;
+    block.setOffset(m_offset + pos);
+    block.setSize((m_size - pos).cwiseMin(Vector2i::Constant(m_cellSize)));
+}
+
+BlockAccumulator::BlockAccumulator(ImageBlock &target, int blockSize)
+        : m_target(target), m_blockSize(blockSize), m_borderSize(target.getBorderSize()) {
+    if (m_borderSize > blockSize)
+        throw NoriException("BlockAccumulator: the reconstruction filter is too wide!");
+    m_numBlocks = Vector2i(
+        (target.getSize().x() + blockSize - 1) / blockSize,
+        (target.getSize().y() + blockSize - 1) / blockSize);
+
+    int count = m_numBlocks.x() * m_numBlocks.y();
+    m_slots.resize(count);
+    m_slotSizes.resize(count);
+    m_pending.reset(new std::atomic<int>[count]);
+    reset();
+}
+
+void BlockAccumulator::reset(ImageBlock *extra) {
+    m_extra = extra;
+    for (int y=0; y<m_numBlocks.y(); ++y) {
+        for (int x=0; x<m_numBlocks.x(); ++x) {
+            /* Number of scheduled blocks in the 3x3 neighborhood (including
+               this one). Blocks without any are never finalized */
+            int pending = 0;
+            for (int ny=std::max(y - 1, 0); ny<=std::min(y + 1, m_numBlocks.y() - 1); ++ny)
+                for (int nx=std::max(x - 1, 0); nx<=std::min(x + 1, m_numBlocks.x() - 1); ++nx)
+                    if (m_scheduled.empty() || m_scheduled[ny * m_numBlocks.x() + nx])
+                        ++pending;
+            m_pending[y * m_numBlocks.x() + x] = pending;
+        }
+    }
+}
+
+void BlockAccumulator::setScheduled(const std::vector<bool> &scheduled) {
+    if (scheduled.size() != m_slots.size())
+        throw NoriException("BlockAccumulator::setScheduled(): expected %i entries, got %i!",
+                            m_slots.size(), scheduled.size());
+    m_scheduled = scheduled;
+}
+
+void BlockAccumulator::put(const ImageBlock &block) {
+    if (block.getBorderSize() != m_borderSize)
+        throw NoriException("BlockAccumulator::put(): border size mismatch!");
+
+    Vector2i pos = (block.getOffset() - m_target.getOffset()) / m_blockSize;
+    int index = pos.y() * m_numBlocks.x() + pos.x();
+
+    /* Store a copy of the block (including its border) */
+    Vector2i size = block.getSize() + Vector2i::Constant(2 * m_borderSize);
+    m_slots[index] = block.topLeftCorner(size.y(), size.x());
+    m_slotSizes[index] = size;
+
+    /* Luminance moments don't extend into the border and can be copied directly */
+    if (m_target.hasMoments() && block.hasMoments()) {
+        Vector2i offset = block.getOffset() - m_target.getOffset();
+        for (int y=0; y<block.getSize().y(); ++y)
+            for (int x=0; x<block.getSize().x(); ++x)
+                m_target.getMoments(offset.x() + x, offset.y() + y) += block.getMoments(x, y);
+    }
+
+    /* Finalize the neighbors for which this was the last missing block */
+    for (int y=std::max(pos.y() - 1, 0); y<=std::min(pos.y() + 1, m_numBlocks.y() - 1); ++y)
+        for (int x=std::max(pos.x() - 1, 0); x<=std::min(pos.x() + 1, m_numBlocks.x() - 1); ++x)
+            if (--m_pending[y * m_numBlocks.x() + x] == 0)
+                finalize(x, y);
+}
+
+void BlockAccumulator::finalize(int bx, int by) {
+    /* Region of the target owned by this block (in array coordinates). Blocks
+       at the edge of the image also own the adjacent part of the border */
+    Point2i min(bx * m_blockSize + m_borderSize, by * m_blockSize + m_borderSize);
+    Point2i max = min + Vector2i::Constant(m_blockSize);
+    if (bx == 0)
+        min.x() = 0;
+    if (by == 0)
+        min.y() = 0;
+    if (bx == m_numBlocks.x() - 1)
+        max.x() = (int) m_target.cols();
+    if (by == m_numBlocks.y() - 1)
+        max.y() = (int) m_target.rows();
+
+    /* Lock the affected stripes of the target (in ascending order) */
+    int firstStripe = m_target.getStripe(min.y()),
+        lastStripe  = m_target.getStripe(max.y() - 1);
+    for (int i=firstStripe; i<=lastStripe; ++i)
+        m_target.lockStripe(i);
+
+    /* Add the contributions of the neighbors in a fixed order */
+    for (int y=std::max(by - 1, 0); y<=std::min(by + 1, m_numBlocks.y() - 1); ++y) {
+        for (int x=std::max(bx - 1, 0); x<=std::min(bx + 1, m_numBlocks.x() - 1); ++x) {
+            int index = y * m_numBlocks.x() + x;
+            if (!m_scheduled.empty() && !m_scheduled[index])
+                continue;
+            Point2i slotMin(x * m_blockSize, y * m_blockSize);
+            Point2i lo = slotMin.cwiseMax(min),
+                    hi = (slotMin + m_slotSizes[index]).cwiseMin(max);
+            if ((hi.array() <= lo.array()).any())
+                continue;
+            Vector2i size = hi - lo;
+            Point2i src = lo - slotMin;
+
+            m_target.block(lo.y(), lo.x(), size.y(), size.x()) +=
+                m_slots[index].block(src.y(), src.x(), size.y(), size.x());
+            if (m_extra)
+                m_extra->block(lo.y(), lo.x(), size.y(), size.x()) +=
+                    m_slots[index].block(src.y(), src.x(), size.y(), size.x());
+        }
+    }
+
+    for (int i=firstStripe; i<=lastStripe; ++i)
+        m_target.unlockStripe(i);
+}
+
+StreamingAccumulator::StreamingAccumulator(const Vector2i &size, const Point2i &offset,
+        int blockSize, const ReconstructionFilter *filter, const Callback &callback)
+        : m_offset(offset), m_size(size), m_blockSize(blockSize), m_callback(callback),
+          m_memory(0), m_peakMemory(0) {
+    /* Same border as the image blocks */
+    m_borderSize = filter ? (int) std::ceil(filter->getRadius() - 0.5f) : 0;
+    if (m_borderSize > blockSize)
+        throw NoriException("StreamingAccumulator: the reconstruction filter is too wide!");
+    m_numBlocks = Vector2i(
+        (size.x() + blockSize - 1) / blockSize,
+        (size.y() + blockSize - 1) / blockSize);
+
+    int count = m_numBlocks.x() * m_numBlocks.y();
+    m_slots.resize(count);
+    m_pending.reset(new std::atomic<int>[count]);
+    m_users.reset(new std::atomic<int>[count]);
+    for (int y=0; y<m_numBlocks.y(); ++y) {
+        for (int x=0; x<m_numBlocks.x(); ++x) {
+            int neighbors = 0;
+            forNeighbors(x, y, [&](int, int) { ++neighbors; });
+            m_pending[y * m_numBlocks.x() + x] = neighbors;
+            m_users[y * m_numBlocks.x() + x] = neighbors;
+        }
+    }
+}
+
+void StreamingAccumulator::put(const ImageBlock &block) {
+    if (block.getBorderSize() != m_borderSize)
+        throw NoriException("StreamingAccumulator::put(): border size mismatch!");
+
+    Vector2i pos = (block.getOffset() - m_offset) / m_blockSize;
+    int index = pos.y() * m_numBlocks.x() + pos.x();
+
+    /* Store a copy of the block (including its border) */
+    Vector2i size = block.getSize() + Vector2i::Constant(2 * m_borderSize);
+    m_slots[index].reset(new Storage(block.topLeftCorner(size.y(), size.x())));
+    size_t memory = (m_memory += sizeof(Color4f) * size.x() * size.y());
+    size_t peak = m_peakMemory;
+    while (memory > peak && !m_peakMemory.compare_exchange_weak(peak, memory))
+        ;
+
+    /* Finalize the neighbors for which this was the last missing block */
+    forNeighbors(pos.x(), pos.y(), [&](int x, int y) {
+        if (--m_pending[y * m_numBlocks.x() + x] == 0)
+            finalize(x, y);
+    });
+}
+
+void StreamingAccumulator::finalize(int bx, int by) {
+    /* Pixels owned by this block (in array coordinates, i.e. including the
+       border). Unlike BlockAccumulator, the image border is discarded */
+    Point2i min(bx * m_blockSize + m_borderSize, by * m_blockSize + m_borderSize);
+    Point2i max = (min + Vector2i::Constant(m_blockSize)).cwiseMin(
+        m_size + Vector2i::Constant(m_borderSize));
+    Vector2i ownedSize = max - min;
+    Storage sum = Storage::Constant(ownedSize.y(), ownedSize.x(), Color4f(0.0f, 0.0f, 0.0f, 0.0f));
+
+    /* Add the contributions of the neighbors in a fixed order */
+    forNeighbors(bx, by, [&](int x, int y) {
+        const Storage &slot = *m_slots[y * m_numBlocks.x() + x];
+        Point2i slotMin(x * m_blockSize, y * m_blockSize);
+        Point2i lo = slotMin.cwiseMax(min),
+                hi = (slotMin + Vector2i((int) slot.cols(), (int) slot.rows())).cwiseMin(max);
+        if ((hi.array() <= lo.array()).any())
+            return;
+        Vector2i size = hi - lo;
+        Point2i src = lo - slotMin, dst = lo - min;
+        sum.block(dst.y(), dst.x(), size.y(), size.x()) +=
+            slot.block(src.y(), src.x(), size.y(), size.x());
+    });
+
+    Bitmap pixels(ownedSize);
+    for (int y=0; y<ownedSize.y(); ++y)
+        for (int x=0; x<ownedSize.x(); ++x)
+            pixels.coeffRef(y, x) = sum.coeff(y, x).divideByFilterWeight();
+    m_callback(Point2i(bx, by), pixels);
+
+    /* Release the neighbors that are no longer needed */
+    forNeighbors(bx, by, [&](int x, int y) {
+        int index = y * m_numBlocks.x() + x;
+        if (--m_users[index] == 0) {
+            m_memory -= sizeof(Color4f) * m_slots[index]->size();
+            m_slots[index].reset();
+        }
+    });
+}
+
 NORI_NAMESPACE_END
@@ -0,0 +1,144 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/bluenoise.h>
+#include <nori/vector.h>
+#include <nori/hash.h>
+#include <pcg32.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Generates a blue noise dither mask using the void-and-cluster method
+ *
+ * Pixels are ranked by repeatedly inserting a point into the largest void
+ * (or removing one from the tightest cluster) of a binary pattern, where
+ * voids and clusters are found by filtering with a toroidal Gaussian.
+ */
+class VoidAndCluster {
+public:
+    VoidAndCluster(int size, float sigma)
+        : m_size(size), m_pattern(size * size, false), m_energy(size * size, 0.0f),
+          m_kernel(size * size) {
+        for (int y = 0; y < size; ++y) {
+            for (int x = 0; x < size; ++x) {
+                int dx = std::min(x, size - x), dy = std::min(y, size - y);
+                m_kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+            }
+        }
+    }
+
+    /// Return the rank of every pixel
+    std::vector<uint32_t> generate() {
+        int count = m_size * m_size, ones = 0;
+        std::vector<uint32_t> result(count);
+
+        /* Initial binary pattern with ~10% of the pixels set */
+        pcg32 random;
+        while (ones < count / 10) {
+            int index = (int) random.nextUInt((uint32_t) count);
+            if (!m_pattern[index]) {
+                toggle(index);
+                ones++;
+            }
+        }
+
+        /* Distribute it evenly by moving points from clusters to voids */
+        while (true) {
+            int cluster = find(true);
+            toggle(cluster);
+            int gap = find(false);
+            toggle(gap);
+            if (gap == cluster)
+                break;
+        }
+        std::vector<bool> initial = m_pattern;
+        std::vector<float> initialEnergy = m_energy;
+
+        /* Rank the initial points by removing them from the tightest cluster */
+        for (int rank = ones - 1; rank >= 0; --rank) {
+            int cluster = find(true);
+            toggle(cluster);
+            result[cluster] = rank;
+        }
+
+        /* Rank the remaining pixels by filling the largest voids. Once more
+           than half of the pixels are set, the pixel with the lowest energy
+           is also the tightest cluster of the unset pixels, as the kernel
+           sums to the same value everywhere */
+        m_pattern = initial;
+        m_energy = initialEnergy;
+        for (int rank = ones; rank < count; ++rank) {
+            int gap = find(false);
+            toggle(gap);
+            result[gap] = rank;
+        }
+
+        return result;
+    }
+
+protected:
+    /// Set or clear a pixel and update the filtered pattern
+    void toggle(int index) {
+        float sign = m_pattern[index] ? -1.0f : 1.0f;
+        m_pattern[index] = !m_pattern[index];
+        int px = index % m_size, py = index / m_size;
+        for (int y = 0; y < m_size; ++y) {
+            const float *kernel = &m_kernel[mod(y - py, m_size) * m_size];
+            float *energy = &m_energy[y * m_size];
+            for (int x = 0; x < m_size; ++x)
+                energy[x] += sign * kernel[mod(x - px, m_size)];
+        }
+    }
+
+    /// Find the tightest cluster (\c value = true) or largest void
+    int find(bool value) const {
+        int best = -1;
+        for (int i = 0; i < (int) m_energy.size(); ++i) {
+            if (m_pattern[i] != value)
+                continue;
+            if (best < 0 || (value ? m_energy[i] > m_energy[best]
+                                   : m_energy[i] < m_energy[best]))
+                best = i;
+        }
+        return best;
+    }
+
+private:
+    int m_size;
+    std::vector<bool> m_pattern;
+    std::vector<float> m_energy;
+    std::vector<float> m_kernel;
+};
+
+uint32_t getBlueNoiseMask(const Point2i &pixel, uint32_t component) {
+    static std::vector<uint32_t> mask = [] {
+        /* Convert the ranks into binary fractions */
+        std::vector<uint32_t> ranks = VoidAndCluster(NORI_BLUE_NOISE_SIZE, 1.5f).generate();
+        for (uint32_t &rank : ranks)
+            rank = (uint32_t) (((uint64_t) rank << 32) / ranks.size());
+        return ranks;
+    }();
+
+    uint32_t offset = hashInt(component), wrap = NORI_BLUE_NOISE_SIZE - 1;
+    uint32_t x = ((uint32_t) pixel.x() + offset) & wrap,
+             y = ((uint32_t) pixel.y() + (offset >> 16)) & wrap;
+    return mask[y * NORI_BLUE_NOISE_SIZE + x];
+}
+
+NORI_NAMESPACE_END
@@ -21,6 +21,7 @@
 #include <Eigen/LU>
 #include <filesystem/resolver.h>
 #include <iomanip>
+#include <mutex>
 
 #if defined(PLATFORM_LINUX)
 #include <malloc.h>
@@ -128,6 +129,15 @@ std::vector<std::string> tokenize(const std::string &string, const std::string &
     return tokens;
 }
 
+std::string stripExtension(const std::string &path) {
+    size_t start = path.find_last_of("/\\");
+    start = start == std::string::npos ? 0 : start + 1;
+    size_t lastdot = path.find_last_of('.');
+    if (lastdot == std::string::npos || lastdot <= start || path.compare(start, std::string::npos, "..") == 0)
+        return path;
+    return path.substr(0, lastdot);
+}
+
 std::string timeString(double time, bool precise) {
     if (std::isnan(time) || std::isinf(time))
         return "inf";
@@ -170,6 +180,12 @@ std::string memString(size_t size, bool precise) {
     return os.str();
 }
 
+void logMessage(const std::string &message) {
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    cout << message << endl;
+}
+
 filesystem::resolver *getFileResolver() {
     static filesystem::resolver *resolver = new filesystem::resolver();
     return resolver;
@@ -0,0 +1,335 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/mesh.h>
+#include <nori/bsdf.h>
+#include <nori/emitter.h>
+#include <nori/timer.h>
+#include <filesystem/resolver.h>
+#include <Eigen/Geometry>
+#include <fstream>
+
+NORI_NAMESPACE_BEGIN
+
+/// Evaluate a cubic Bezier curve (and optionally its derivative) at \c u
+static Vector4f evalBezier(const Vector4f cp[4], float u, Vector4f *deriv = nullptr) {
+    Vector4f cp1[3] = {
+        (1 - u) * cp[0] + u * cp[1],
+        (1 - u) * cp[1] + u * cp[2],
+        (1 - u) * cp[2] + u * cp[3]
+    };
+    Vector4f cp2[2] = {
+        (1 - u) * cp1[0] + u * cp1[1],
+        (1 - u) * cp1[1] + u * cp1[2]
+    };
+    if (deriv)
+        *deriv = 3 * (cp2[1] - cp2[0]);
+    return (1 - u) * cp2[0] + u * cp2[1];
+}
+
+/// Split a cubic Bezier curve at u=0.5 (the halves share \c result[3])
+static void subdivideBezier(const Vector4f cp[4], Vector4f result[7]) {
+    result[0] = cp[0];
+    result[1] = (cp[0] + cp[1]) / 2;
+    result[2] = (cp[0] + 2 * cp[1] + cp[2]) / 4;
+    result[3] = (cp[0] + 3 * cp[1] + 3 * cp[2] + cp[3]) / 8;
+    result[4] = (cp[1] + 2 * cp[2] + cp[3]) / 4;
+    result[5] = (cp[2] + cp[3]) / 2;
+    result[6] = cp[3];
+}
+
+/**
+ * \brief Hair and fur curves
+ *
+ * Stores a set of strands made of linear or cubic Bezier segments with
+ * a radius per control point. Curves are intersected as flat ribbons
+ * that always face the incident ray (following the approach of PBRT v3),
+ * with a shading normal that is bent across the width of the ribbon so
+ * that strands appear round.
+ *
+ * The \c filename property references a binary file (little endian)
+ * with the following layout:
+ *
+ * <tt>
+ *   char     magic[4];              // "NCRV"
+ *   uint32_t degree;                // 1 (linear) or 3 (cubic Bezier)
+ *   uint32_t strandCount;
+ *   uint32_t vertexCount;
+ *   uint32_t strandVertices[strandCount];
+ *   float    vertices[vertexCount][4];  // x, y, z, radius
+ * </tt>
+ *
+ * The vertices of each strand are stored consecutively. Cubic strands
+ * need 3k+1 vertices and share end points between adjacent segments.
+ * An optional \c toWorld transformation is applied to the positions;
+ * radii are given in world space units.
+ */
+class Curves : public Mesh {
+public:
+    Curves(const PropertyList &propList) {
+        filesystem::path filename =
+            getFileResolver()->resolve(propList.getString("filename"));
+
+        std::ifstream is(filename.str(), std::ios::binary);
+        if (is.fail())
+            throw NoriException("Unable to open curve file \"%s\"!", filename);
+        Transform trafo = propList.getTransform("toWorld", Transform());
+
+        /* Shapes may be loaded in parallel, so the message is printed at the end */
+        Timer timer;
+
+        char magic[4];
+        uint32_t header[3];
+        is.read(magic, 4);
+        is.read(reinterpret_cast<char *>(header), sizeof(header));
+        if (is.fail() || memcmp(magic, "NCRV", 4) != 0)
+            throw NoriException("\"%s\" is not a valid curve file!", filename);
+
+        m_degree = header[0];
+        if (m_degree != 1 && m_degree != 3)
+            throw NoriException("Curve file \"%s\": unsupported degree %i!", filename, m_degree);
+
+        std::vector<uint32_t> strandVertices(header[1]);
+        is.read(reinterpret_cast<char *>(strandVertices.data()), sizeof(uint32_t) * header[1]);
+        m_points.resize(4, header[2]);
+        is.read(reinterpret_cast<char *>(m_points.data()), sizeof(float) * m_points.size());
+        if (is.fail())
+            throw NoriException("Unable to read curve file \"%s\"!", filename);
+
+        for (uint32_t i=0; i<m_points.cols(); ++i)
+            m_points.col(i).head<3>() = trafo * Point3f(m_points.col(i).head<3>());
+
+        /* Create the list of segments */
+        uint32_t offset = 0;
+        for (uint32_t count : strandVertices) {
+            if (count < 2 || (m_degree == 3 && (count - 1) % 3 != 0))
+                throw NoriException("Curve file \"%s\": invalid strand vertex count %i!", filename, count);
+            for (uint32_t i=0; i+1<count; i += m_degree)
+                m_segments.push_back(offset + i);
+            offset += count;
+        }
+        if (offset != m_points.cols())
+            throw NoriException("Curve file \"%s\": vertex count mismatch!", filename);
+
+        /* Choose a subdivision depth for each segment (see \ref recursiveIntersect()) */
+        m_depth.resize(m_segments.size());
+        for (uint32_t i=0; i<getPrimitiveCount(); ++i) {
+            Vector4f cp[4];
+            getControlPoints(i, cp);
+            float L0 = 0, radius = 0;
+            for (int k=0; k<2; ++k)
+                L0 = std::max(L0, Vector3f((cp[k] - 2 * cp[k+1] + cp[k+2]).head<3>()).norm());
+            for (int k=0; k<4; ++k)
+                radius = std::max(radius, cp[k].w());
+            float eps = radius * 0.1f, value = SQRT_TWO * 6.0f * L0 / (8.0f * eps);
+            int depth = value >= 1 ? (int) std::log2(value) / 2 : 0;
+            m_depth[i] = (uint8_t) clamp(depth, 0, 10);
+
+            m_bbox.expandBy(getBoundingBox(i));
+        }
+
+        m_name = filename.str();
+        logMessage(tfm::format("Loading \"%s\" .. done. (strands=%i, segments=%i, took %s and %s)",
+            filename, strandVertices.size(), m_segments.size(), timer.elapsedString(),
+            memString(m_points.size() * sizeof(float) +
+                      m_segments.size() * (sizeof(uint32_t) + sizeof(uint8_t)))));
+    }
+
+    uint32_t getPrimitiveCount() const { return (uint32_t) m_segments.size(); }
+
+    /// Approximate the area by that of a cylinder along the control polygon
+    float surfaceArea(uint32_t index) const {
+        Vector4f cp[4];
+        getControlPoints(index, cp);
+        float length = 0;
+        for (int k=0; k<3; ++k)
+            length += Vector3f((cp[k+1] - cp[k]).head<3>()).norm();
+        return M_PI * (cp[0].w() + cp[3].w()) * length;
+    }
+
+    BoundingBox3f getBoundingBox(uint32_t index) const {
+        /* The curve lies within the convex hull of its control points */
+        Vector4f cp[4];
+        getControlPoints(index, cp);
+        BoundingBox3f result;
+        for (int k=0; k<4; ++k) {
+            Vector3f r = Vector3f::Constant(cp[k].w());
+            result.expandBy(Point3f(cp[k].head<3>() - r));
+            result.expandBy(Point3f(cp[k].head<3>() + r));
+        }
+        return result;
+    }
+
+    Point3f getCentroid(uint32_t index) const {
+        Vector4f cp[4];
+        getControlPoints(index, cp);
+        return evalBezier(cp, 0.5f).head<3>();
+    }
+
+    bool rayIntersect(uint32_t index, const Ray3f &ray, float &u, float &v, float &t) const {
+        /* Transform the control points into a coordinate system where
+           the ray starts at the origin and points along +Z */
+        Vector4f cp[4];
+        getControlPoints(index, cp);
+        float rayLength = ray.d.norm();
+        Frame frame(ray.d / rayLength);
+        for (int k=0; k<4; ++k)
+            cp[k].head<3>() = frame.toLocal(cp[k].head<3>() - ray.o);
+
+        float zMin = ray.mint * rayLength, zMax = ray.maxt * rayLength, z;
+        if (!recursiveIntersect(cp, 0.0f, 1.0f, m_depth[index], zMin, zMax, u, v, z))
+            return false;
+
+        t = z / rayLength;
+        return true;
+    }
+
+    void setHitInformation(uint32_t index, const Ray3f &ray, Intersection &its) const {
+        Vector4f cp[4], deriv;
+        getControlPoints(index, cp);
+        evalBezier(cp, its.uv.x(), &deriv);
+        Vector3f tangent = deriv.head<3>();
+
+        its.p = ray(its.t);
+        its.mesh = this;
+
+        /* The ribbon faces the ray: remove the tangential component of -d */
+        Vector3f n = -ray.d;
+        float tangentNorm2 = tangent.squaredNorm();
+        if (tangentNorm2 > 0)
+            n -= tangent * (n.dot(tangent) / tangentNorm2);
+        if (n.squaredNorm() == 0)
+            n = -ray.d;
+        n.normalize();
+        its.geoFrame = Frame(n);
+
+        /* Bend the shading normal across the ribbon to mimic a cylinder */
+        if (tangentNorm2 > 0) {
+            Vector3f b = tangent.normalized().cross(n);
+            float theta = (its.uv.y() - 0.5f) * M_PI, sinTheta, cosTheta;
+            sincosf(theta, &sinTheta, &cosTheta);
+            its.shFrame = Frame((cosTheta * n + sinTheta * b).normalized());
+        } else {
+            its.shFrame = its.geoFrame;
+        }
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "Curves[\n"
+            "  name = \"%s\",\n"
+            "  degree = %i,\n"
+            "  segmentCount = %i,\n"
+            "  bsdf = %s,\n"
+            "  emitter = %s\n"
+            "]",
+            m_name,
+            m_degree,
+            m_segments.size(),
+            m_bsdf ? indent(m_bsdf->toString()) : std::string("null"),
+            m_emitter ? indent(m_emitter->toString()) : std::string("null")
+        );
+    }
+
+protected:
+    /// Return the control points of a segment in cubic Bezier form
+    void getControlPoints(uint32_t index, Vector4f cp[4]) const {
+        uint32_t first = m_segments[index];
+        if (m_degree == 3) {
+            for (int k=0; k<4; ++k)
+                cp[k] = m_points.col(first + k);
+        } else {
+            /* Degree elevation of a linear segment */
+            Vector4f p0 = m_points.col(first), p1 = m_points.col(first + 1);
+            cp[0] = p0;
+            cp[1] = (2 * p0 + p1) / 3;
+            cp[2] = (p0 + 2 * p1) / 3;
+            cp[3] = p1;
+        }
+    }
+
+    /**
+     * \brief Intersect a curve segment given in ray space
+     *
+     * Recursively subdivides the segment (\c depth times) while culling
+     * pieces whose bounding box does not contain the ray, and then
+     * intersects the remaining pieces as straight ribbons. On success,
+     * \c zMax is set to the ray-space distance of the closest hit.
+     */
+    bool recursiveIntersect(const Vector4f cp[4], float u0, float u1, int depth,
+                            float zMin, float &zMax, float &u, float &v, float &z) const {
+        /* Bounding box test in ray space */
+        float radius = std::max(std::max(cp[0].w(), cp[1].w()), std::max(cp[2].w(), cp[3].w()));
+        Vector3f bmin = Vector3f::Constant( std::numeric_limits<float>::infinity()),
+                 bmax = Vector3f::Constant(-std::numeric_limits<float>::infinity());
+        for (int k=0; k<4; ++k) {
+            bmin = bmin.cwiseMin(cp[k].head<3>());
+            bmax = bmax.cwiseMax(cp[k].head<3>());
+        }
+        if (bmin.x() - radius > 0 || bmax.x() + radius < 0 ||
+            bmin.y() - radius > 0 || bmax.y() + radius < 0 ||
+            bmin.z() - radius > zMax || bmax.z() + radius < zMin)
+            return false;
+
+        if (depth > 0) {
+            Vector4f split[7];
+            subdivideBezier(cp, split);
+            float uMid = 0.5f * (u0 + u1);
+            bool hit = recursiveIntersect(split, u0, uMid, depth - 1, zMin, zMax, u, v, z);
+            hit |= recursiveIntersect(split + 3, uMid, u1, depth - 1, zMin, zMax, u, v, z);
+            return hit;
+        }
+
+        /* Reject rays beyond the tangent-perpendicular lines at both end points */
+        float edge = (cp[1].y() - cp[0].y()) * -cp[0].y() + cp[0].x() * (cp[0].x() - cp[1].x());
+        if (edge < 0)
+            return false;
+        edge = (cp[2].y() - cp[3].y()) * -cp[3].y() + cp[3].x() * (cp[3].x() - cp[2].x());
+        if (edge < 0)
+            return false;
+
+        /* Closest point to the ray along the segment */
+        Vector2f dir = (cp[3] - cp[0]).head<2>();
+        float denom = dir.squaredNorm();
+        if (denom == 0)
+            return false;
+        float w = clamp(-cp[0].head<2>().dot(dir) / denom, 0.0f, 1.0f);
+
+        Vector4f deriv, pc = evalBezier(cp, w, &deriv);
+        float hitRadius = pc.w(), dist2 = pc.x() * pc.x() + pc.y() * pc.y();
+        if (dist2 > hitRadius * hitRadius || pc.z() < zMin || pc.z() > zMax)
+            return false;
+
+        /* Signed offset across the ribbon (0..1 with 0.5 at the center) */
+        float dist = std::sqrt(dist2);
+        float side = deriv.x() * -pc.y() + pc.x() * deriv.y();
+        v = (side > 0) ? 0.5f + 0.5f * dist / hitRadius : 0.5f - 0.5f * dist / hitRadius;
+        u = u0 + w * (u1 - u0);
+        z = zMax = pc.z();
+        return true;
+    }
+
+private:
+    uint32_t m_degree;               ///< Degree of the segments (1 or 3)
+    MatrixXf m_points;               ///< Control points and radii
+    std::vector<uint32_t> m_segments; ///< Index of the first control point of each segment
+    std::vector<uint8_t> m_depth;    ///< Subdivision depth of each segment
+};
+
+NORI_REGISTER_CLASS(Curves, "curves");
+NORI_NAMESPACE_END
@@ -0,0 +1,116 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/mesh.h>
+#include <nori/bsdf.h>
+#include <nori/emitter.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Analytic disk shape
+ *
+ * A flat disk specified by its \c center, \c normal
+ * and \c radius, which is intersected exactly.
+ */
+class Disk : public Mesh {
+public:
+    Disk(const PropertyList &propList) {
+        m_center = propList.getPoint("center", Point3f(0.0f));
+        m_radius = propList.getFloat("radius", 1.0f);
+        m_frame = Frame(propList.getVector("normal", Vector3f(0, 0, 1)).normalized());
+        m_name = "disk";
+
+        if (!(m_radius > 0))
+            throw NoriException("Disk: the radius must be positive!");
+
+        /* Bounding box of the disk: its extent along each axis
+           is radius * sqrt(1 - n_i^2) */
+        Vector3f extents;
+        for (int i=0; i<3; ++i)
+            extents[i] = m_radius * std::sqrt(std::max(0.0f, 1 - m_frame.n[i] * m_frame.n[i]));
+        m_bbox = BoundingBox3f(m_center - extents, m_center + extents);
+    }
+
+    uint32_t getPrimitiveCount() const { return 1; }
+
+    float surfaceArea(uint32_t) const { return M_PI * m_radius * m_radius; }
+
+    BoundingBox3f getBoundingBox(uint32_t) const { return m_bbox; }
+
+    Point3f getCentroid(uint32_t) const { return m_center; }
+
+    bool rayIntersect(uint32_t, const Ray3f &ray, float &u, float &v, float &t) const {
+        float dn = ray.d.dot(m_frame.n);
+        if (dn == 0)
+            return false;
+
+        t = (m_center - ray.o).dot(m_frame.n) / dn;
+        if (!(t >= ray.mint && t <= ray.maxt))
+            return false;
+
+        /* Local position of the hit point within the plane of the disk */
+        Vector3f local = m_frame.toLocal(ray(t) - m_center);
+        if (local.x() * local.x() + local.y() * local.y() > m_radius * m_radius)
+            return false;
+
+        u = local.x();
+        v = local.y();
+        return true;
+    }
+
+    void setHitInformation(uint32_t, const Ray3f &, Intersection &its) const {
+        /* Recompute the position from the planar coordinates so that it lies exactly on the disk */
+        float x = its.uv.x(), y = its.uv.y();
+        its.p = m_center + x * m_frame.s + y * m_frame.t;
+        its.mesh = this;
+
+        /* Polar texture coordinates: (angle, normalized radius) */
+        float phi = std::atan2(y, x);
+        if (phi < 0)
+            phi += 2 * M_PI;
+        its.uv = Point2f(phi * INV_TWOPI, std::sqrt(x*x + y*y) / m_radius);
+
+        its.geoFrame = its.shFrame = m_frame;
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "Disk[\n"
+            "  center = %s,\n"
+            "  normal = %s,\n"
+            "  radius = %f,\n"
+            "  bsdf = %s,\n"
+            "  emitter = %s\n"
+            "]",
+            m_center.toString(),
+            m_frame.n.toString(),
+            m_radius,
+            m_bsdf ? indent(m_bsdf->toString()) : std::string("null"),
+            m_emitter ? indent(m_emitter->toString()) : std::string("null")
+        );
+    }
+
+private:
+    Point3f m_center;
+    Frame m_frame;
+    float m_radius;
+};
+
+NORI_REGISTER_CLASS(Disk, "disk");
+NORI_NAMESPACE_END
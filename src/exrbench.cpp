@@ -0,0 +1,162 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/bitmap.h>
+#include <nori/object.h>
+#include <nori/timer.h>
+#include <pcg32.h>
+#include <cstdio>
+#include <fstream>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief OpenEXR output benchmark and test
+ *
+ * Writes a large image with every compression method (none, ZIP, PIZ
+ * and DWAA), once with float and once with half precision channels, and
+ * prints a table of the write times and file sizes. The image is either
+ * loaded from the \c input file (e.g. a render) or synthesized as a
+ * smooth gradient with per-pixel noise, which compresses similarly to a
+ * path traced image at a moderate sample count.
+ *
+ * Every file is read back: the lossless methods must reproduce the
+ * image exactly (float) or up to the precision of a half (half). DWAA
+ * is lossy, so its average relative error is only reported.
+ */
+class EXRBenchmark : public NoriObject {
+public:
+    EXRBenchmark(const PropertyList &propList) {
+        /* Image to write (synthesized if empty) */
+        m_input = propList.getString("input", "");
+
+        /* Size of the synthesized image (default: 4K UHD) */
+        m_width = propList.getInteger("width", 3840);
+        m_height = propList.getInteger("height", 2160);
+
+        /* Prefix of the written files, which are deleted afterwards */
+        m_filename = propList.getString("filename", "exrbench");
+
+        /* Number of threads used to compress the data (-1: one per core) */
+        m_threadCount = propList.getInteger("threadCount", -1);
+    }
+
+    void activate() {
+        int total = 0, passed = 0;
+        static const char *names[] = { "none", "zip", "piz", "dwaa" };
+
+        std::unique_ptr<Bitmap> image;
+        if (m_input.empty()) {
+            image.reset(new Bitmap(Vector2i(m_width, m_height)));
+            pcg32 random;
+            for (int y=0; y<m_height; ++y) {
+                for (int x=0; x<m_width; ++x) {
+                    float u = (float) x / m_width, v = (float) y / m_height;
+                    Color3f base(0.2f + 0.8f * u, 0.5f + 0.4f * std::sin(6 * v), 0.3f + 0.5f * u * v);
+                    image->coeffRef(y, x) = base * (0.8f + 0.4f * random.nextFloat());
+                }
+            }
+        } else {
+            image.reset(new Bitmap(m_input));
+        }
+
+        std::string table = tfm::format("%-12s %-6s %12s %12s\n", "Compression", "Type", "Time", "Size");
+        for (int half=0; half<2; ++half) {
+            for (int compression=0; compression<4; ++compression) {
+                cout << "------------------------------------------------------" << endl;
+                EXROptions options;
+                options.compression = (EXROptions::ECompression) compression;
+                options.half = half == 1;
+                options.threadCount = m_threadCount;
+                std::string filename = tfm::format("%s-%s-%s", m_filename,
+                    names[compression], half ? "half" : "float");
+
+                Timer timer;
+                image->saveEXR(filename, options);
+                double elapsed = timer.elapsed();
+
+                std::string path = filename + ".exr";
+                std::ifstream is(path, std::ios::binary | std::ios::ate);
+                table += tfm::format("%-12s %-6s %12s %12s\n", names[compression],
+                    half ? "half" : "float", timeString(elapsed), memString((size_t) is.tellg()));
+                is.close();
+
+                /* Read the file back and compare */
+                Bitmap result(path);
+                std::remove(path.c_str());
+                double maxError = 0, sumError = 0;
+                for (int y=0; y<image->rows(); ++y) {
+                    for (int x=0; x<image->cols(); ++x) {
+                        const Color3f &ref = image->coeff(y, x), &value = result.coeff(y, x);
+                        float error = ((value - ref).abs() / ref.abs().max(1e-3f)).maxCoeff();
+                        maxError = std::max(maxError, (double) error);
+                        sumError += error;
+                    }
+                }
+                double meanError = sumError / image->size();
+                if (options.compression == EXROptions::EDWAA) {
+                    cout << tfm::format("Lossy compression: mean relative error %e", meanError) << endl;
+                    continue;
+                }
+
+                /* A half has an 11-bit significand */
+                ++total;
+                bool ok = maxError <= (half ? 4.9e-4 : 0.0);
+                cout << tfm::format("Maximum relative error: %e (%s)", maxError,
+                    ok ? "passed" : "failed") << endl;
+                if (ok)
+                    ++passed;
+            }
+        }
+
+        cout << "------------------------------------------------------" << endl;
+        cout << tfm::format("Writing a %ix%i image:", image->cols(), image->rows()) << endl << table;
+        cout << "Passed " << passed << "/" << total << " tests." << endl;
+        if (passed < total)
+            throw std::runtime_error("Some tests failed :(");
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "EXRBenchmark[\n"
+            "  input = \"%s\",\n"
+            "  width = %i,\n"
+            "  height = %i,\n"
+            "  filename = \"%s\",\n"
+            "  threadCount = %i\n"
+            "]",
+            m_input,
+            m_width,
+            m_height,
+            m_filename,
+            m_threadCount
+        );
+    }
+
+    EClassType getClassType() const { return ETest; }
+
+private:
+    std::string m_input;
+    int m_width;
+    int m_height;
+    std::string m_filename;
+    int m_threadCount;
+};
+
+NORI_REGISTER_CLASS(EXRBenchmark, "exrbench");
+NORI_NAMESPACE_END
@@ -81,6 +81,8 @@ NoriScreen::NoriScreen(const ImageBlock &block)
     glBindTexture(GL_TEXTURE_2D, m_texture);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, block.getSize().x(), block.getSize().y(),
+        0, GL_RGBA, GL_FLOAT, nullptr);
 
     drawAll();
     setVisible(true);
@@ -92,18 +94,23 @@ NoriScreen::~NoriScreen() {
 }
 
 void NoriScreen::drawContents() {
-    /* Reload the partially rendered image onto the GPU */
-    m_block.lock();
+    /* Reload the partially rendered image onto the GPU. This is done one
+       stripe at a time so that rendering threads are only blocked while
+       the stripe they are writing to is being uploaded */
     int borderSize = m_block.getBorderSize();
     const Vector2i &size = m_block.getSize();
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, m_texture);
     glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint) m_block.cols());
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, size.x(), size.y(),
-            0, GL_RGBA, GL_FLOAT, (uint8_t *) m_block.data() +
-            (borderSize * m_block.cols() + borderSize) * sizeof(Color4f));
+    for (int i=0; i<m_block.getStripeCount(); ++i) {
+        int y = i * NORI_BLOCK_SIZE, height = std::min(NORI_BLOCK_SIZE, size.y() - y);
+        m_block.lockStripe(i);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, size.x(), height, GL_RGBA, GL_FLOAT,
+            (uint8_t *) m_block.data() +
+            ((borderSize + y) * m_block.cols() + borderSize) * sizeof(Color4f));
+        m_block.unlockStripe(i);
+    }
     glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-    m_block.unlock();
 
     glViewport(0, GLsizei(36 * mPixelRatio), GLsizei(mPixelRatio*size[0]),
          GLsizei(mPixelRatio*size[1]));
@@ -18,6 +18,7 @@
 
 #include <nori/sampler.h>
 #include <nori/block.h>
+#include <nori/xoshiro8.h>
 #include <pcg32.h>
 
 NORI_NAMESPACE_BEGIN
@@ -27,8 +28,9 @@ NORI_NAMESPACE_BEGIN
  * random numbers on <tt>[0, 1)x[0, 1)</tt>.
  *
  * This class is essentially just a wrapper around the pcg32 pseudorandom
- * number generator. For more details on what sample generators do in
- * general, refer to the \ref Sampler class.
+ * number generator. Batches of samples (see \ref generateBatch()) come
+ * from a separate, vectorized generator. For more details on what sample
+ * generators do in general, refer to the \ref Sampler class.
  */
 class Independent : public Sampler {
 public:
@@ -42,17 +44,23 @@ public:
         std::unique_ptr<Independent> cloned(new Independent());
         cloned->m_sampleCount = m_sampleCount;
         cloned->m_random = m_random;
+        cloned->m_batchRandom = m_batchRandom;
         return std::move(cloned);
     }
 
-    void prepare(const ImageBlock &block) {
+    void prepare(const ImageBlock &block, uint32_t pass) {
+        /* Every pass uses a separate stream */
         m_random.seed(
             block.getOffset().x(),
-            block.getOffset().y()
+            block.getOffset().y() + ((uint64_t) pass << 32)
+        );
+        m_batchRandom.seed(
+            block.getOffset().x(),
+            block.getOffset().y() + ((uint64_t) pass << 32)
         );
     }
 
-    void generate() { /* No-op for this sampler */ }
+    void generate(const Point2i &, uint32_t) { /* No-op for this sampler */ }
     void advance()  { /* No-op for this sampler */ }
 
     float next1D() {
@@ -66,6 +74,11 @@ public:
         );
     }
 
+    void generateBatch(uint32_t count, uint32_t dimensions, Point2f *result) {
+        static_assert(sizeof(Point2f) == 2 * sizeof(float), "Point2f must not be padded");
+        m_batchRandom.nextFloat((float *) result, (size_t) count * dimensions * 2);
+    }
+
     std::string toString() const {
         return tfm::format("Independent[sampleCount=%i]", m_sampleCount);
     }
@@ -74,6 +87,7 @@ protected:
 
 private:
     pcg32 m_random;
+    Xoshiro8 m_batchRandom;
 };
 
 NORI_REGISTER_CLASS(Independent, "independent");
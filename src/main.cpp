@@ -18,169 +18,281 @@
 
 #include <nori/parser.h>
 #include <nori/scene.h>
-#include <nori/camera.h>
 #include <nori/block.h>
-#include <nori/timer.h>
 #include <nori/bitmap.h>
-#include <nori/sampler.h>
-#include <nori/integrator.h>
+#include <nori/render.h>
+#if defined(NORI_BUILD_GUI)
 #include <nori/gui.h>
-#include <tbb/parallel_for.h>
-#include <tbb/blocked_range.h>
+#endif
+#include <nori/timer.h>
+#include <tbb/task_scheduler_init.h>
 #include <filesystem/resolver.h>
-#include <thread>
+#include <memory>
 
 using namespace nori;
 
-static void renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block) {
-    const Camera *camera = scene->getCamera();
-    const Integrator *integrator = scene->getIntegrator();
-
-    Point2i offset = block.getOffset();
-    Vector2i size  = block.getSize();
-
-    /* Clear the block contents */
-    block.clear();
-
-    /* For each pixel and pixel sample sample */
-    for (int y=0; y<size.y(); ++y) {
-        for (int x=0; x<size.x(); ++x) {
-            for (uint32_t i=0; i<sampler->getSampleCount(); ++i) {
-                Point2f pixelSample = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D();
-                Point2f apertureSample = sampler->next2D();
+/// Parse a partition of the form <index>/<count>
+static void parsePartition(const std::string &value, int &index, int &count) {
+    std::vector<std::string> tokens = tokenize(value, "/");
+    if (tokens.size() != 2)
+        throw NoriException("Expected a partition of the form <index>/<count>!");
+    index = toInt(tokens[0]);
+    count = toInt(tokens[1]);
+    if (count < 1 || index < 0 || index >= count)
+        throw NoriException("Invalid partition \"%s\"!", value);
+}
 
-                /* Sample a ray from the camera */
-                Ray3f ray;
-                Color3f value = camera->sampleRay(ray, pixelSample, apertureSample);
+static void printUsage(const char *name) {
+    cerr << "Syntax: " << name << " [options] <scene.xml | image.exr>" << endl
+         << "        " << name << " [options] --server" << endl
+         << "Options:" << endl
+         << "  --headless            Render without opening a window" << endl
+         << "  --threads <count>     Number of worker threads (default: one per core)" << endl
+         << "  --spp <count>         Override the number of samples per pixel" << endl
+         << "  --resolution <WxH>    Override the output resolution" << endl
+         << "  --crop <x,y,w,h>      Only render the given crop window" << endl
+         << "  --output <filename>   Output filename (default: based on the scene filename)" << endl
+         << "  --compression <type>  OpenEXR compression: none, zip (default), piz or dwaa" << endl
+         << "  --half                Store half precision values in OpenEXR files" << endl
+         << "  --streaming           Write finished tiles directly to a tiled EXR file" << endl
+         << "  --pass-spp <count>    Render progressively in passes of this many samples per pixel" << endl
+         << "  --time-budget <sec>   Stop a progressive render after this much time" << endl
+         << "  --noise-threshold <x> Stop a progressive render once the relative noise is below x" << endl
+         << "  --adaptive <x>        Adaptively sample pixels until their relative error is below x" << endl
+         << "  --variance            Also write an image of the per-pixel variance" << endl
+         << "  --spiral              Schedule blocks in spiral order (no cost-aware scheduling)" << endl
+         << "  --filter-sampling     Importance sample the reconstruction filter instead of splatting" << endl
+         << "  --raw-samples         Also write the raw samples for refiltering with nori-refilter" << endl
+         << "  --raw-quantize        Like --raw-samples, but quantize the samples to 8 bytes" << endl
+         << "  --checkpoint <sec>    Save the render state after a pass at most this often" << endl
+         << "  --resume              Continue from the last checkpoint" << endl
+         << "  --snapshot <sec>      Periodically write a tonemapped snapshot" << endl
+         << "  --tiles <i/N>         Only render tile set i of N and write a partial buffer" << endl
+         << "  --passes <i/N>        Only render pass set i of N and write a partial buffer" << endl
+         << "  --numa                Run one pinned group of threads per NUMA node" << endl
+         << "  --numa-replicate      Like --numa, and copy the mesh data to every node" << endl
+         << "  --progress <seconds>  Interval between progress reports in headless mode" << endl
+         << "  --server              Read render jobs (one command line per line) from stdin" << endl;
+}
 
-                /* Compute the incident radiance */
-                value *= integrator->Li(scene, sampler, ray);
+/**
+ * \brief Parse command line arguments
+ *
+ * \c server is \c nullptr for the jobs of a render server, which
+ * cannot start another server.
+ */
+static void parseArguments(const std::vector<std::string> &args, RenderOptions &options,
+                           std::string &filename, bool *server) {
+    for (size_t i=0; i<args.size(); ++i) {
+        const std::string &arg = args[i];
+        if (arg == "--headless") {
+            options.headless = true;
+            continue;
+        } else if (arg == "--variance") {
+            options.varianceOutput = true;
+            continue;
+        } else if (arg == "--half") {
+            options.exrOptions.half = true;
+            continue;
+        } else if (arg == "--streaming") {
+            options.streamingOutput = true;
+            continue;
+        } else if (arg == "--spiral") {
+            options.spiralScheduling = true;
+            continue;
+        } else if (arg == "--filter-sampling") {
+            options.filterSampling = true;
+            continue;
+        } else if (arg == "--raw-samples") {
+            options.rawSamples = true;
+            continue;
+        } else if (arg == "--raw-quantize") {
+            options.rawSamples = options.rawQuantization = true;
+            continue;
+        } else if (arg == "--resume") {
+            options.resume = true;
+            continue;
+        } else if (arg == "--numa") {
+            options.numa = true;
+            continue;
+        } else if (arg == "--numa-replicate") {
+            options.numa = options.numaReplication = true;
+            continue;
+        } else if (arg == "--server" && server) {
+            *server = true;
+            continue;
+        } else if (arg.compare(0, 2, "--") != 0) {
+            if (!filename.empty())
+                throw NoriException("Only one scene or image can be specified!");
+            filename = arg;
+            continue;
+        }
 
-                /* Store in the image block */
-                block.put(pixelSample, value);
-            }
+        if (i + 1 >= args.size())
+            throw NoriException("Missing value for option \"%s\"!", arg);
+        const std::string &value = args[++i];
+
+        if (arg == "--threads") {
+            options.threadCount = toInt(value);
+        } else if (arg == "--spp") {
+            options.sampleCount = toInt(value);
+        } else if (arg == "--resolution") {
+            std::vector<std::string> tokens = tokenize(value, "x");
+            if (tokens.size() != 2)
+                throw NoriException("Expected a resolution of the form <width>x<height>!");
+            options.resolution = Vector2i(toInt(tokens[0]), toInt(tokens[1]));
+        } else if (arg == "--crop") {
+            std::vector<std::string> tokens = tokenize(value, ",");
+            if (tokens.size() != 4)
+                throw NoriException("Expected a crop window of the form <x>,<y>,<width>,<height>!");
+            options.cropOffset = Point2i(toInt(tokens[0]), toInt(tokens[1]));
+            options.cropSize = Vector2i(toInt(tokens[2]), toInt(tokens[3]));
+        } else if (arg == "--output") {
+            options.outputName = value;
+        } else if (arg == "--compression") {
+            options.exrOptions.compression = EXROptions::parseCompression(value);
+        } else if (arg == "--pass-spp") {
+            options.passSampleCount = toInt(value);
+        } else if (arg == "--time-budget") {
+            options.timeBudget = toFloat(value);
+        } else if (arg == "--noise-threshold") {
+            options.noiseThreshold = toFloat(value);
+        } else if (arg == "--adaptive") {
+            options.adaptiveThreshold = toFloat(value);
+        } else if (arg == "--checkpoint") {
+            options.checkpointInterval = toFloat(value);
+        } else if (arg == "--snapshot") {
+            options.snapshotInterval = toFloat(value);
+        } else if (arg == "--tiles") {
+            parsePartition(value, options.tilePartIndex, options.tilePartCount);
+        } else if (arg == "--passes") {
+            parsePartition(value, options.passPartIndex, options.passPartCount);
+        } else if (arg == "--progress") {
+            options.progressInterval = toFloat(value);
+        } else {
+            throw NoriException("Unknown option \"%s\"!", arg);
         }
     }
 }
 
-static void render(Scene *scene, const std::string &filename) {
-    const Camera *camera = scene->getCamera();
-    Vector2i outputSize = camera->getOutputSize();
-    scene->getIntegrator()->preprocess(scene);
-
-    /* Create a block generator (i.e. a work scheduler) */
-    BlockGenerator blockGenerator(outputSize, NORI_BLOCK_SIZE);
-
-    /* Allocate memory for the entire output image and clear it */
-    ImageBlock result(outputSize, camera->getReconstructionFilter());
-    result.clear();
-
-    /* Create a window that visualizes the partially rendered result */
-    nanogui::init();
-    NoriScreen *screen = new NoriScreen(result);
+/// Render a scene or display an OpenEXR image
+static void runJob(const std::string &filename, const RenderOptions &options) {
+    filesystem::path path(filename);
+
+    if (path.extension() == "xml") {
+        /* Add the parent directory of the scene file to the
+           file resolver. That way, the XML file can reference
+           resources (OBJ files, textures) using relative paths */
+        getFileResolver()->prepend(path.parent_path());
+
+        std::unique_ptr<NoriObject> root(loadFromXML(filename));
+
+        /* When the XML root object is a scene, start rendering it .. */
+        if (root->getClassType() == NoriObject::EScene)
+            render(static_cast<Scene *>(root.get()), filename, options);
+#if defined(NORI_BUILD_GUI)
+    } else if (path.extension() == "exr" && !options.headless) {
+        /* Alternatively, provide a basic OpenEXR image viewer */
+        Bitmap bitmap(filename);
+        ImageBlock block(Vector2i((int) bitmap.cols(), (int) bitmap.rows()), nullptr);
+        block.fromBitmap(bitmap);
+        nanogui::init();
+        NoriScreen *screen = new NoriScreen(block);
+        nanogui::mainloop();
+        delete screen;
+        nanogui::shutdown();
+#endif
+    } else {
+        cerr << "Fatal error: unknown file \"" << filename
+             << "\", expected an extension of type .xml"
+             << (options.headless ? "" : " or .exr") << endl;
+    }
+}
 
-    /* Do the following in parallel and asynchronously */
-    std::thread render_thread([&] {
-        cout << "Rendering .. ";
-        cout.flush();
+/**
+ * \brief Render server: read jobs from standard input until it is closed
+ *
+ * Every line holds the command line of a job (scene and options). The
+ * options given when starting the server serve as defaults. Geometry
+ * loaded from files is kept in a cache across jobs, so that variations
+ * of a scene (lighting, camera, sample counts) only reparse the XML
+ * description and reload what has changed. A named pipe can be used to
+ * submit jobs from other processes. A job given <tt>--threads</tt> renders
+ * with that many threads (see \ref render()), which cannot exceed the
+ * number of threads of the server.
+ */
+static void runServer(const RenderOptions &defaults) {
+    Mesh::setCacheEnabled(true);
+    cout << "Render server ready, reading jobs from standard input" << endl;
+
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        std::vector<std::string> args = tokenize(line, " \t");
+        if (args.empty() || args[0][0] == '#')
+            continue;
+        if (args[0] == "quit")
+            break;
+
+        /* Scenes reference resources relative to their own directory */
+        filesystem::resolver resolver = *getFileResolver();
         Timer timer;
+        try {
+            RenderOptions options = defaults;
+            std::string filename;
+            parseArguments(args, options, filename, nullptr);
+            if (filename.empty())
+                throw NoriException("No scene was specified!");
+            options.headless = true;
+            if (defaults.threadCount > 0 && options.threadCount > defaults.threadCount)
+                throw NoriException("A job cannot use more threads than the server (%i)!",
+                                    defaults.threadCount);
+            runJob(filename, options);
+            cout << "Job finished (took " << timer.elapsedString() << ")" << endl;
+        } catch (const std::exception &e) {
+            cerr << "Job failed: " << e.what() << endl;
+        }
+        *getFileResolver() = resolver;
 
-        tbb::blocked_range<int> range(0, blockGenerator.getBlockCount());
-
-        auto map = [&](const tbb::blocked_range<int> &range) {
-            /* Allocate memory for a small image block to be rendered
-               by the current thread */
-            ImageBlock block(Vector2i(NORI_BLOCK_SIZE),
-                camera->getReconstructionFilter());
-
-            /* Create a clone of the sampler for the current thread */
-            std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
-
-            for (int i=range.begin(); i<range.end(); ++i) {
-                /* Request an image block from the block generator */
-                blockGenerator.next(block);
-
-                /* Inform the sampler about the block to be rendered */
-                sampler->prepare(block);
-
-                /* Render all contained pixels */
-                renderBlock(scene, sampler.get(), block);
-
-                /* The image block has been processed. Now add it to
-                   the "big" block that represents the entire image */
-                result.put(block);
-            }
-        };
-
-        /// Uncomment the following line for single threaded rendering
-        // map(range);
-
-        /// Default: parallel rendering
-        tbb::parallel_for(range, map);
-
-        cout << "done. (took " << timer.elapsedString() << ")" << endl;
-    });
-
-    /* Enter the application main loop */
-    nanogui::mainloop();
-
-    /* Shut down the user interface */
-    render_thread.join();
-
-    delete screen;
-    nanogui::shutdown();
-
-    /* Now turn the rendered image block into
-       a properly normalized bitmap */
-    std::unique_ptr<Bitmap> bitmap(result.toBitmap());
-
-    /* Determine the filename of the output bitmap */
-    std::string outputName = filename;
-    size_t lastdot = outputName.find_last_of(".");
-    if (lastdot != std::string::npos)
-        outputName.erase(lastdot, std::string::npos);
-
-    /* Save using the OpenEXR format */
-    bitmap->saveEXR(outputName);
-
-    /* Save tonemapped (sRGB) output using the PNG format */
-    bitmap->savePNG(outputName);
+        /* Release the geometry of shapes that are no longer used */
+        Mesh::pruneCache();
+    }
+    Mesh::setCacheEnabled(false);
 }
 
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        cerr << "Syntax: " << argv[0] << " <scene.xml>" << endl;
+    RenderOptions options;
+    std::string filename;
+    bool server = false;
+
+    try {
+        parseArguments(std::vector<std::string>(argv + 1, argv + argc), options, filename, &server);
+        if (server && !filename.empty())
+            throw NoriException("A render server cannot be given a scene!");
+        if (!server && filename.empty())
+            throw NoriException("No scene or image was specified!");
+    } catch (const std::exception &e) {
+        cerr << "Error: " << e.what() << endl;
+        printUsage(argv[0]);
         return -1;
     }
 
-    filesystem::path path(argv[1]);
+#if !defined(NORI_BUILD_GUI)
+    /* Without the graphical user interface, every render is headless */
+    options.headless = true;
+#endif
+
+    /* Limit the number of worker threads if requested (this must
+       happen before any parallel work, including scene loading) */
+    tbb::task_scheduler_init init(options.threadCount > 0 ? options.threadCount
+                                    : tbb::task_scheduler_init::automatic);
+
+    if (server) {
+        runServer(options);
+        return 0;
+    }
 
     try {
-        if (path.extension() == "xml") {
-            /* Add the parent directory of the scene file to the
-               file resolver. That way, the XML file can reference
-               resources (OBJ files, textures) using relative paths */
-            getFileResolver()->prepend(path.parent_path());
-
-            std::unique_ptr<NoriObject> root(loadFromXML(argv[1]));
-
-            /* When the XML root object is a scene, start rendering it .. */
-            if (root->getClassType() == NoriObject::EScene)
-                render(static_cast<Scene *>(root.get()), argv[1]);
-        } else if (path.extension() == "exr") {
-            /* Alternatively, provide a basic OpenEXR image viewer */
-            Bitmap bitmap(argv[1]);
-            ImageBlock block(Vector2i((int) bitmap.cols(), (int) bitmap.rows()), nullptr);
-            block.fromBitmap(bitmap);
-            nanogui::init();
-            NoriScreen *screen = new NoriScreen(block);
-            nanogui::mainloop();
-            delete screen;
-            nanogui::shutdown();
-        } else {
-            cerr << "Fatal error: unknown file \"" << argv[1]
-                 << "\", expected an extension of type .xml or .exr" << endl;
-        }
+        runJob(filename, options);
     } catch (const std::exception &e) {
         cerr << "Fatal error: " << e.what() << endl;
         return -1;
@@ -0,0 +1,136 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/block.h>
+#include <nori/bitmap.h>
+#include <fstream>
+#include <memory>
+
+/**
+ * nori-merge: combines the partial buffers written by distributed
+ * renders (<tt>nori --tiles i/N</tt> or <tt>nori --passes i/N</tt>).
+ *
+ * The buffers store unnormalized sums of the filtered samples along with
+ * the filter weights, so the merged image is simply their sum, normalized
+ * by the summed weights. It equals a single-process render up to the
+ * order of the floating point additions.
+ */
+
+using namespace nori;
+
+static void printUsage(const char *name) {
+    cerr << "Syntax: " << name << " [options] <partial> [<partial> ...]" << endl
+         << "Options:" << endl
+         << "  --compression <type>  OpenEXR compression: none, zip (default), piz or dwaa" << endl
+         << "  --half                Store half precision values in OpenEXR files" << endl
+         << "  --output <filename>   Output filename (default: based on the first partial)" << endl
+         << "  --variance            Also write an image of the per-pixel variance" << endl;
+}
+
+/// Remove the extension and the partition suffix added by nori
+static std::string baseName(const std::string &path) {
+    std::string filename = stripExtension(path);
+    for (const char *suffix : { "_tiles", "_passes" }) {
+        size_t pos = filename.rfind(suffix);
+        if (pos != std::string::npos && filename.find('/', pos) == std::string::npos)
+            filename.erase(pos, std::string::npos);
+    }
+    return filename;
+}
+
+int main(int argc, char **argv) {
+    std::vector<std::string> filenames;
+    std::string outputName;
+    bool varianceOutput = false;
+    EXROptions exrOptions;
+
+    try {
+        for (int i=1; i<argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--variance") {
+                varianceOutput = true;
+            } else if (arg == "--half") {
+                exrOptions.half = true;
+            } else if (arg == "--compression") {
+                if (i + 1 >= argc)
+                    throw NoriException("Missing value for option \"%s\"!", arg);
+                exrOptions.compression = EXROptions::parseCompression(argv[++i]);
+            } else if (arg == "--output") {
+                if (i + 1 >= argc)
+                    throw NoriException("Missing value for option \"%s\"!", arg);
+                outputName = argv[++i];
+            } else if (arg.compare(0, 2, "--") == 0) {
+                throw NoriException("Unknown option \"%s\"!", arg);
+            } else {
+                filenames.push_back(arg);
+            }
+        }
+        if (filenames.empty())
+            throw NoriException("No partial buffers were specified!");
+    } catch (const std::exception &e) {
+        cerr << "Error: " << e.what() << endl;
+        printUsage(argv[0]);
+        return -1;
+    }
+
+    try {
+        ImageBlock result(Vector2i(1, 1), nullptr), partial(Vector2i(1, 1), nullptr);
+        for (size_t i=0; i<filenames.size(); ++i) {
+            std::ifstream is(filenames[i], std::ios::binary);
+            if (is.fail())
+                throw NoriException("Unable to open \"%s\"!", filenames[i]);
+
+            cout << "Reading \"" << filenames[i] << "\" .. ";
+            cout.flush();
+            (i == 0 ? result : partial).load(is);
+            cout << "done." << endl;
+            if (i == 0)
+                continue;
+
+            if (partial.getOffset() != result.getOffset() ||
+                partial.getSize() != result.getSize() ||
+                partial.getBorderSize() != result.getBorderSize())
+                throw NoriException("\"%s\" covers a different region of the image than \"%s\"!",
+                                    filenames[i], filenames[0]);
+            if (partial.hasMoments() != result.hasMoments())
+                result.setMomentsEnabled(false);
+
+            result.put(partial);
+        }
+
+        outputName = outputName.empty() ? baseName(filenames[0])
+                                        : stripExtension(outputName);
+
+        /* Normalize by the summed filter weights and save the result */
+        std::unique_ptr<Bitmap> bitmap(result.toBitmap());
+        bitmap->saveEXR(outputName, exrOptions);
+        bitmap->savePNG(outputName);
+
+        if (varianceOutput) {
+            if (!result.hasMoments())
+                throw NoriException("The partial buffers contain no variance "
+                                    "estimates (render them with --variance)!");
+            std::unique_ptr<Bitmap> variance(result.toVarianceBitmap());
+            variance->saveEXR(outputName + "_variance", exrOptions);
+        }
+    } catch (const std::exception &e) {
+        cerr << "Fatal error: " << e.what() << endl;
+        return -1;
+    }
+    return 0;
+}
@@ -22,9 +22,23 @@
 #include <nori/emitter.h>
 #include <nori/warp.h>
 #include <Eigen/Geometry>
+#include <unordered_map>
+#include <sys/stat.h>
+#include <memory>
+#include <mutex>
 
 NORI_NAMESPACE_BEGIN
 
+/// Entry of the geometry cache (see \ref Mesh::setCacheEnabled())
+struct GeometryCacheEntry {
+    std::shared_ptr<const CachedGeometry> geometry;
+    bool used = true;
+};
+
+static std::mutex geometryCacheMutex;
+static bool geometryCacheEnabled = false;
+static std::unordered_map<std::string, GeometryCacheEntry> geometryCache;
+
 Mesh::Mesh() { }
 
 Mesh::~Mesh() {
@@ -41,16 +55,34 @@ void Mesh::activate() {
 }
 
 float Mesh::surfaceArea(uint32_t index) const {
-    uint32_t i0 = m_F(0, index), i1 = m_F(1, index), i2 = m_F(2, index);
+    const MatrixXf &V = getVertexPositions();
+    const MatrixXu &F = getIndices(), &Q = getQuadIndices();
+
+    if (isQuad(index)) {
+        index -= getTriangleCount();
+        const Point3f p0 = V.col(Q(0, index)), p1 = V.col(Q(1, index)),
+                      p2 = V.col(Q(2, index)), p3 = V.col(Q(3, index));
+
+        return 0.5f * (Vector3f((p1 - p0).cross(p2 - p0)).norm() +
+                       Vector3f((p2 - p0).cross(p3 - p0)).norm());
+    }
+
+    uint32_t i0 = F(0, index), i1 = F(1, index), i2 = F(2, index);
 
-    const Point3f p0 = m_V.col(i0), p1 = m_V.col(i1), p2 = m_V.col(i2);
+    const Point3f p0 = V.col(i0), p1 = V.col(i1), p2 = V.col(i2);
 
     return 0.5f * Vector3f((p1 - p0).cross(p2 - p0)).norm();
 }
 
 bool Mesh::rayIntersect(uint32_t index, const Ray3f &ray, float &u, float &v, float &t) const {
-    uint32_t i0 = m_F(0, index), i1 = m_F(1, index), i2 = m_F(2, index);
-    const Point3f p0 = m_V.col(i0), p1 = m_V.col(i1), p2 = m_V.col(i2);
+    if (isQuad(index))
+        return rayIntersectQuad(index - getTriangleCount(), ray, u, v, t);
+
+    const MatrixXf &V = local(getVertexPositions(), &Replica::V);
+    const MatrixXu &F = local(getIndices(), &Replica::F);
+
+    uint32_t i0 = F(0, index), i1 = F(1, index), i2 = F(2, index);
+    const Point3f p0 = V.col(i0), p1 = V.col(i1), p2 = V.col(i2);
 
     /* Find vectors for two edges sharing v[0] */
     Vector3f edge1 = p1 - p0, edge2 = p2 - p0;
@@ -87,18 +119,246 @@ bool Mesh::rayIntersect(uint32_t index, const Ray3f &ray, float &u, float &v, fl
     return t >= ray.mint && t <= ray.maxt;
 }
 
+bool Mesh::rayIntersectQuad(uint32_t index, const Ray3f &ray, float &u, float &v, float &t) const {
+    const MatrixXf &V = local(getVertexPositions(), &Replica::V);
+    const MatrixXu &Q = local(getQuadIndices(), &Replica::Q);
+    const Point3f p00 = V.col(Q(0, index)), p10 = V.col(Q(1, index)),
+                  p11 = V.col(Q(2, index)), p01 = V.col(Q(3, index));
+
+    /* Edges of the patch and (unnormalized) normal at its center */
+    Vector3f e10 = p10 - p00, e11 = p11 - p10, e00 = p01 - p00;
+    Vector3f qn = e10.cross(p01 - p11);
+    Vector3f q00 = p00 - ray.o, q10 = p10 - ray.o;
+
+    /* Coefficients of the quadratic equation in 'u' */
+    float a = q00.cross(ray.d).dot(e00),
+          c = qn.dot(ray.d),
+          b = q10.cross(ray.d).dot(e11) - (a + c);
+
+    float det = b*b - 4*a*c;
+    if (det < 0)
+        return false;
+    det = std::sqrt(det);
+
+    float u1, u2;
+    if (c == 0) {
+        /* Planar patch (or ray parallel to the patch normal): linear case */
+        if (b == 0)
+            return false;
+        u1 = -a / b;
+        u2 = -1;
+    } else {
+        u1 = (-b - std::copysign(det, b)) / 2;
+        u2 = a / u1;
+        u1 /= c;
+    }
+
+    /* For each candidate 'u', find the closest point on the corresponding
+       isoline and accept it if the ray passes through it */
+    bool found = false;
+    float roots[2] = { u1, u2 };
+    for (int i=0; i<2; ++i) {
+        float ur = roots[i];
+        if (!(ur >= 0 && ur <= 1))
+            continue;
+        Vector3f pa = (1 - ur) * q00 + ur * q10;
+        Vector3f pb = (1 - ur) * e00 + ur * e11;
+        Vector3f n = ray.d.cross(pb);
+        float n2 = n.squaredNorm();
+        if (n2 == 0)
+            continue;
+        n = n.cross(pa);
+        float tr = n.dot(pb) / n2, vr = n.dot(ray.d) / n2;
+        if (vr >= 0 && vr <= 1 && tr >= ray.mint && tr <= ray.maxt && (!found || tr < t)) {
+            u = ur; v = vr; t = tr;
+            found = true;
+        }
+    }
+
+    return found;
+}
+
 BoundingBox3f Mesh::getBoundingBox(uint32_t index) const {
-    BoundingBox3f result(m_V.col(m_F(0, index)));
-    result.expandBy(m_V.col(m_F(1, index)));
-    result.expandBy(m_V.col(m_F(2, index)));
+    const MatrixXf &V = getVertexPositions();
+    const MatrixXu &F = getIndices(), &Q = getQuadIndices();
+
+    if (isQuad(index)) {
+        index -= getTriangleCount();
+        BoundingBox3f result(V.col(Q(0, index)));
+        for (int k=1; k<4; ++k)
+            result.expandBy(V.col(Q(k, index)));
+        return result;
+    }
+
+    BoundingBox3f result(V.col(F(0, index)));
+    result.expandBy(V.col(F(1, index)));
+    result.expandBy(V.col(F(2, index)));
     return result;
 }
 
 Point3f Mesh::getCentroid(uint32_t index) const {
+    const MatrixXf &V = getVertexPositions();
+    const MatrixXu &F = getIndices(), &Q = getQuadIndices();
+
+    if (isQuad(index)) {
+        index -= getTriangleCount();
+        return 0.25f *
+            (V.col(Q(0, index)) +
+             V.col(Q(1, index)) +
+             V.col(Q(2, index)) +
+             V.col(Q(3, index)));
+    }
+
     return (1.0f / 3.0f) *
-        (m_V.col(m_F(0, index)) +
-         m_V.col(m_F(1, index)) +
-         m_V.col(m_F(2, index)));
+        (V.col(F(0, index)) +
+         V.col(F(1, index)) +
+         V.col(F(2, index)));
+}
+
+void Mesh::setHitInformation(uint32_t index, const Ray3f &, Intersection &its) const {
+    const MatrixXf &V = local(getVertexPositions(), &Replica::V), &N = local(getVertexNormals(), &Replica::N),
+                   &UV = local(getVertexTexCoords(), &Replica::UV);
+    const MatrixXu &F = local(getIndices(), &Replica::F), &Q = local(getQuadIndices(), &Replica::Q);
+
+    /* Vertex indices and interpolation weights of the primitive */
+    uint32_t idx[4];
+    float w[4];
+    int n;
+
+    if (isQuad(index)) {
+        index -= getTriangleCount();
+        float u = its.uv.x(), v = its.uv.y();
+        for (int k=0; k<4; ++k)
+            idx[k] = Q(k, index);
+        w[0] = (1-u) * (1-v); w[1] = u * (1-v);
+        w[2] = u * v;         w[3] = (1-u) * v;
+        n = 4;
+
+        /* Tangents of the bilinear patch */
+        const Point3f p0 = V.col(idx[0]), p1 = V.col(idx[1]),
+                      p2 = V.col(idx[2]), p3 = V.col(idx[3]);
+        Vector3f dpdu = (1-v) * (p1 - p0) + v * (p2 - p3),
+                 dpdv = (1-u) * (p3 - p0) + u * (p2 - p1);
+        its.geoFrame = Frame(dpdu.cross(dpdv).normalized());
+    } else {
+        for (int k=0; k<3; ++k)
+            idx[k] = F(k, index);
+        w[0] = 1 - its.uv.sum(); w[1] = its.uv.x(); w[2] = its.uv.y();
+        n = 3;
+
+        const Point3f p0 = V.col(idx[0]), p1 = V.col(idx[1]), p2 = V.col(idx[2]);
+        its.geoFrame = Frame((p1-p0).cross(p2-p0).normalized());
+    }
+
+    its.mesh = this;
+
+    /* Compute the intersection positon accurately
+       using the interpolation weights */
+    its.p = Point3f::Zero();
+    for (int k=0; k<n; ++k)
+        its.p += w[k] * V.col(idx[k]);
+
+    /* Compute proper texture coordinates if provided by the mesh */
+    if (UV.size() > 0) {
+        its.uv = Point2f::Zero();
+        for (int k=0; k<n; ++k)
+            its.uv += w[k] * UV.col(idx[k]);
+    }
+
+    if (N.size() > 0) {
+        /* Compute the shading frame. Note that for simplicity,
+           the current implementation doesn't attempt to provide
+           tangents that are continuous across the surface. That
+           means that this code will need to be modified to be able
+           use anisotropic BRDFs, which need tangent continuity */
+        Vector3f normal = Vector3f::Zero();
+        for (int k=0; k<n; ++k)
+            normal += w[k] * N.col(idx[k]);
+        its.shFrame = Frame(normal.normalized());
+    } else {
+        its.shFrame = its.geoFrame;
+    }
+}
+
+/// Spread the lower 10 bits of \c v so that there are two zero bits between each
+static inline uint32_t expandBits(uint32_t v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+/// Compute a 30-bit Morton code for a point in the unit cube
+static inline uint32_t mortonCode(const Point3f &p) {
+    uint32_t x = (uint32_t) clamp(p.x() * 1024.0f, 0.0f, 1023.0f),
+             y = (uint32_t) clamp(p.y() * 1024.0f, 0.0f, 1023.0f),
+             z = (uint32_t) clamp(p.z() * 1024.0f, 0.0f, 1023.0f);
+    return (expandBits(x) << 2) | (expandBits(y) << 1) | expandBits(z);
+}
+
+void Mesh::optimize() {
+    /* Map primitive centroids into the unit cube */
+    Vector3f extents = m_bbox.getExtents(), scale;
+    for (int i=0; i<3; ++i)
+        scale[i] = extents[i] > 0 ? 1.0f / extents[i] : 0.0f;
+
+    /* Compute Morton codes for all non-degenerate primitives
+       (triangles and quads are sorted separately) */
+    auto sortPrimitives = [&](const MatrixXu &indices, uint32_t base) {
+        std::vector<std::pair<uint32_t, uint32_t>> order;
+        order.reserve(indices.cols());
+        for (uint32_t f=0; f<(uint32_t) indices.cols(); ++f) {
+            if (!(surfaceArea(base + f) > 0))
+                continue;
+            Point3f p = (getCentroid(base + f) - m_bbox.min).cwiseProduct(scale);
+            order.push_back(std::make_pair(mortonCode(p), f));
+        }
+        std::sort(order.begin(), order.end());
+        return order;
+    };
+
+    auto triangles = sortPrimitives(m_F, 0);
+    auto quads = sortPrimitives(m_Q, getTriangleCount());
+
+    /* Renumber the vertices in the order of their first use */
+    std::vector<uint32_t> remap(getVertexCount(), (uint32_t) -1);
+    uint32_t vertexCount = 0;
+
+    auto reindex = [&](const MatrixXu &indices,
+                       const std::vector<std::pair<uint32_t, uint32_t>> &order) {
+        MatrixXu result(indices.rows(), order.size());
+        for (uint32_t f=0; f<(uint32_t) order.size(); ++f) {
+            for (int k=0; k<indices.rows(); ++k) {
+                uint32_t &index = remap[indices(k, order[f].second)];
+                if (index == (uint32_t) -1)
+                    index = vertexCount++;
+                result(k, f) = index;
+            }
+        }
+        return result;
+    };
+
+    m_F = reindex(m_F, triangles);
+    m_Q = reindex(m_Q, quads);
+
+    auto permute = [&](const MatrixXf &source) {
+        MatrixXf result(source.rows(), vertexCount);
+        for (uint32_t i=0; i<(uint32_t) source.cols(); ++i)
+            if (remap[i] != (uint32_t) -1)
+                result.col(remap[i]) = source.col(i);
+        return result;
+    };
+
+    m_V = permute(m_V);
+    if (m_N.size() > 0)
+        m_N = permute(m_N);
+    if (m_UV.size() > 0)
+        m_UV = permute(m_UV);
+
+    m_bbox.reset();
+    for (uint32_t i=0; i<vertexCount; ++i)
+        m_bbox.expandBy(m_V.col(i));
 }
 
 void Mesh::addChild(NoriObject *obj) {
@@ -131,12 +391,14 @@ std::string Mesh::toString() const {
         "  name = \"%s\",\n"
         "  vertexCount = %i,\n"
         "  triangleCount = %i,\n"
+        "  quadCount = %i,\n"
         "  bsdf = %s,\n"
         "  emitter = %s\n"
         "]",
         m_name,
-        m_V.cols(),
-        m_F.cols(),
+        getVertexCount(),
+        getTriangleCount(),
+        getQuadCount(),
         m_bsdf ? indent(m_bsdf->toString()) : std::string("null"),
         m_emitter ? indent(m_emitter->toString()) : std::string("null")
     );
@@ -164,4 +426,86 @@ std::string Intersection::toString() const {
     );
 }
 
+void Mesh::setCacheEnabled(bool enabled) {
+    std::lock_guard<std::mutex> guard(geometryCacheMutex);
+    geometryCacheEnabled = enabled;
+    if (!enabled)
+        geometryCache.clear();
+}
+
+void Mesh::pruneCache() {
+    std::lock_guard<std::mutex> guard(geometryCacheMutex);
+    for (auto it = geometryCache.begin(); it != geometryCache.end(); ) {
+        if (it->second.used) {
+            it->second.used = false;
+            ++it;
+        } else {
+            it = geometryCache.erase(it);
+        }
+    }
+}
+
+std::string Mesh::getCacheKey(const std::string &filename, const std::string &params) {
+    {
+        std::lock_guard<std::mutex> guard(geometryCacheMutex);
+        if (!geometryCacheEnabled)
+            return std::string();
+    }
+
+    /* Include the size and modification time so that edited files are reloaded */
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0)
+        return std::string();
+    return tfm::format("%s:%i:%i:", filename, (int64_t) st.st_size, (int64_t) st.st_mtime) + params;
+}
+
+bool Mesh::loadFromCache(const std::string &key) {
+    if (key.empty())
+        return false;
+    std::lock_guard<std::mutex> guard(geometryCacheMutex);
+    auto it = geometryCache.find(key);
+    if (it == geometryCache.end())
+        return false;
+
+    /* Reference the cached matrices instead of copying them */
+    m_cached = it->second.geometry;
+    m_bbox = m_cached->bbox;
+    it->second.used = true;
+    return true;
+}
+
+void Mesh::storeInCache(const std::string &key) {
+    if (key.empty())
+        return;
+    std::shared_ptr<CachedGeometry> geometry = std::make_shared<CachedGeometry>();
+    geometry->V = std::move(m_V); geometry->N = std::move(m_N); geometry->UV = std::move(m_UV);
+    geometry->F = std::move(m_F); geometry->Q = std::move(m_Q);
+    geometry->bbox = m_bbox;
+    m_cached = geometry;
+
+    std::lock_guard<std::mutex> guard(geometryCacheMutex);
+    geometryCache[key].geometry = std::move(geometry);
+}
+
+void Mesh::setReplicaCount(int nodeCount) {
+    m_replicas.clear();
+    m_replicas.resize(nodeCount);
+}
+
+size_t Mesh::replicate(int node) {
+    if (node < 0 || node >= (int) m_replicas.size())
+        throw NoriException("Mesh::replicate(): invalid node index %i!", node);
+
+    /* The copy is allocated and first touched by the calling thread */
+    std::unique_ptr<Replica> replica(new Replica());
+    replica->V = getVertexPositions(); replica->N = getVertexNormals();
+    replica->UV = getVertexTexCoords();
+    replica->F = getIndices(); replica->Q = getQuadIndices();
+
+    size_t size = sizeof(float) * (replica->V.size() + replica->N.size() + replica->UV.size()) +
+                  sizeof(uint32_t) * (replica->F.size() + replica->Q.size());
+    m_replicas[node] = std::move(replica);
+    return size;
+}
+
 NORI_NAMESPACE_END
@@ -0,0 +1,205 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/numa.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_scheduler_observer.h>
+#include <exception>
+#include <fstream>
+#include <thread>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+NORI_NAMESPACE_BEGIN
+
+static thread_local int numaNodeIndex = -1;
+
+#if defined(__linux__)
+/// Affinity of the calling thread before it was pinned by a \ref PinningObserver
+static thread_local cpu_set_t previousAffinity;
+static thread_local bool hasPreviousAffinity = false;
+#endif
+
+int getNumaNodeIndex() {
+    return numaNodeIndex;
+}
+
+std::vector<std::vector<int>> getNumaNodes() {
+    std::vector<std::vector<int>> nodes;
+#if defined(__linux__)
+    /* Node directories are numbered consecutively on all common systems */
+    for (int node = 0; ; ++node) {
+        std::ifstream is(tfm::format("/sys/devices/system/node/node%i/cpulist", node));
+        std::string line;
+        if (is.fail() || !std::getline(is, line))
+            break;
+
+        /* Parse a list of the form "0-7,16-23" */
+        std::vector<int> cpus;
+        for (const std::string &range : tokenize(line, ",")) {
+            std::vector<std::string> bounds = tokenize(range, "-");
+            if (bounds.empty() || bounds.size() > 2)
+                return std::vector<std::vector<int>>();
+            int first = toInt(bounds[0]), last = toInt(bounds.back());
+            for (int cpu = first; cpu <= last; ++cpu)
+                cpus.push_back(cpu);
+        }
+
+        /* Skip nodes without CPUs (e.g. memory-only nodes) */
+        if (!cpus.empty())
+            nodes.push_back(cpus);
+    }
+#endif
+    return nodes;
+}
+
+/**
+ * \brief Pins the threads that enter an arena to the CPUs of a node
+ * and records the node index for \ref getNumaNodeIndex()
+ *
+ * The previous affinity is restored when a thread leaves the arena, so
+ * that threads which only visit it (e.g. the main thread, or workers
+ * that migrate between arenas) are not left pinned to the node.
+ */
+class PinningObserver : public tbb::task_scheduler_observer {
+public:
+    PinningObserver(tbb::task_arena &arena, int node, const std::vector<int> &cpus)
+        : tbb::task_scheduler_observer(arena), m_node(node), m_cpus(cpus) {
+        observe(true);
+    }
+
+    ~PinningObserver() {
+        observe(false);
+    }
+
+    void on_scheduler_entry(bool) {
+        numaNodeIndex = m_node;
+#if defined(__linux__)
+        if (m_cpus.empty())
+            return;
+        hasPreviousAffinity = pthread_getaffinity_np(pthread_self(),
+            sizeof(previousAffinity), &previousAffinity) == 0;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : m_cpus)
+            CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+    }
+
+    void on_scheduler_exit(bool) {
+        numaNodeIndex = -1;
+#if defined(__linux__)
+        if (m_cpus.empty() || !hasPreviousAffinity)
+            return;
+        pthread_setaffinity_np(pthread_self(), sizeof(previousAffinity), &previousAffinity);
+        hasPreviousAffinity = false;
+#endif
+    }
+
+private:
+    int m_node;
+    std::vector<int> m_cpus;
+};
+
+struct NumaArenas::Node {
+    int concurrency;
+    std::vector<int> cpus;
+    tbb::task_arena arena;
+    std::unique_ptr<PinningObserver> observer;
+
+    Node(int index, int concurrency, const std::vector<int> &cpus)
+        : concurrency(concurrency), cpus(cpus), arena(concurrency, 1) {
+        arena.initialize();
+        observer.reset(new PinningObserver(arena, index, cpus));
+    }
+};
+
+NumaArenas::NumaArenas(int threadCount) {
+    std::vector<std::vector<int>> nodes = getNumaNodes();
+    threadCount = std::max(threadCount, 1);
+
+    /* Without topology information (or with fewer threads than nodes),
+       fall back to a single unpinned arena */
+    if (nodes.size() < 2 || threadCount < (int) nodes.size()) {
+        m_nodes.emplace_back(new Node(0, threadCount, std::vector<int>()));
+        return;
+    }
+
+    /* Split the threads in proportion to the number of CPUs per node */
+    size_t cpuCount = 0;
+    for (const auto &cpus : nodes)
+        cpuCount += cpus.size();
+    int assigned = 0;
+    for (size_t i=0; i<nodes.size(); ++i) {
+        int concurrency = i + 1 < nodes.size()
+            ? std::max(1, (int) (threadCount * nodes[i].size() / cpuCount))
+            : threadCount - assigned;
+        concurrency = std::max(1, std::min(concurrency,
+            threadCount - assigned - (int) (nodes.size() - i - 1)));
+        m_nodes.emplace_back(new Node((int) i, concurrency, nodes[i]));
+        assigned += concurrency;
+    }
+}
+
+NumaArenas::~NumaArenas() { }
+
+int NumaArenas::getConcurrency(int node) const {
+    return m_nodes[node]->concurrency;
+}
+
+int NumaArenas::getConcurrency() const {
+    int result = 0;
+    for (const auto &node : m_nodes)
+        result += node->concurrency;
+    return result;
+}
+
+void NumaArenas::execute(const std::function<void(int)> &func) {
+    /* Every node is driven by a separate thread that joins its arena */
+    std::vector<std::exception_ptr> errors(m_nodes.size());
+    std::vector<std::thread> threads;
+    for (size_t i=0; i<m_nodes.size(); ++i) {
+        threads.emplace_back([&, i] {
+            try {
+                m_nodes[i]->arena.execute([&] { func((int) i); });
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+    for (const std::exception_ptr &error : errors)
+        if (error)
+            std::rethrow_exception(error);
+}
+
+std::string NumaArenas::toString() const {
+    std::string nodes;
+    for (size_t i=0; i<m_nodes.size(); ++i) {
+        nodes += tfm::format("%s%i", i > 0 ? "+" : "", m_nodes[i]->concurrency);
+    }
+    return tfm::format("%i NUMA node%s (%s threads)", m_nodes.size(),
+                       m_nodes.size() > 1 ? "s" : "", nodes);
+}
+
+NORI_NAMESPACE_END
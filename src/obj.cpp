@@ -26,6 +26,9 @@ NORI_NAMESPACE_BEGIN
 
 /**
  * \brief Loader for Wavefront OBJ triangle meshes
+ *
+ * Quads are kept as native primitives unless the boolean
+ * property \c splitQuads is set to \c true.
  */
 class WavefrontOBJ : public Mesh {
 public:
@@ -40,14 +43,34 @@ public:
             throw NoriException("Unable to open OBJ file \"%s\"!", filename);
         Transform trafo = propList.getTransform("toWorld", Transform());
 
-        cout << "Loading \"" << filename << "\" .. ";
-        cout.flush();
+        /* Split quads into pairs of triangles instead of keeping them as
+           native bilinear patches? (default: no) */
+        bool splitQuads = propList.getBoolean("splitQuads", false);
+
+        /* Sort the primitives spatially and drop degenerate ones (default: enabled) */
+        bool optimizeMesh = propList.getBoolean("optimize", true);
+
+        m_name = filename.str();
+
+        /* Reuse the geometry if the same file was loaded before (render server) */
+        const Eigen::Matrix4f &matrix = trafo.getMatrix();
+        std::string cacheKey = getCacheKey(filename.str(),
+            tfm::format("obj:%i:%i:", splitQuads, optimizeMesh) +
+            std::string(reinterpret_cast<const char *>(matrix.data()), sizeof(float) * 16));
+        if (loadFromCache(cacheKey)) {
+            logMessage(tfm::format("Reusing \"%s\" (V=%i, F=%i, Q=%i)", filename,
+                                   getVertexCount(), getTriangleCount(), getQuadCount()));
+            return;
+        }
+
+        /* Meshes may be loaded in parallel, so the message is printed at the end */
         Timer timer;
 
         std::vector<Vector3f>   positions;
         std::vector<Vector2f>   texcoords;
         std::vector<Vector3f>   normals;
         std::vector<uint32_t>   indices;
+        std::vector<uint32_t>   quadIndices;
         std::vector<OBJVertex>  vertices;
         VertexMap vertexMap;
 
@@ -77,17 +100,24 @@ public:
                 line >> v1 >> v2 >> v3 >> v4;
                 OBJVertex verts[6];
                 int nVertices = 3;
+                std::vector<uint32_t> *target = &indices;
 
                 verts[0] = OBJVertex(v1);
                 verts[1] = OBJVertex(v2);
                 verts[2] = OBJVertex(v3);
 
                 if (!v4.empty()) {
-                    /* This is a quad, split into two triangles */
                     verts[3] = OBJVertex(v4);
-                    verts[4] = verts[0];
-                    verts[5] = verts[2];
-                    nVertices = 6;
+                    if (splitQuads) {
+                        /* This is a quad, split into two triangles */
+                        verts[4] = verts[0];
+                        verts[5] = verts[2];
+                        nVertices = 6;
+                    } else {
+                        /* This is a quad, keep it as a native primitive */
+                        target = &quadIndices;
+                        nVertices = 4;
+                    }
                 }
                 /* Convert to an indexed vertex list */
                 for (int i=0; i<nVertices; ++i) {
@@ -95,10 +125,10 @@ public:
                     VertexMap::const_iterator it = vertexMap.find(v);
                     if (it == vertexMap.end()) {
                         vertexMap[v] = (uint32_t) vertices.size();
-                        indices.push_back((uint32_t) vertices.size());
+                        target->push_back((uint32_t) vertices.size());
                         vertices.push_back(v);
                     } else {
-                        indices.push_back(it->second);
+                        target->push_back(it->second);
                     }
                 }
             }
@@ -107,6 +137,9 @@ public:
         m_F.resize(3, indices.size()/3);
         memcpy(m_F.data(), indices.data(), sizeof(uint32_t)*indices.size());
 
+        m_Q.resize(4, quadIndices.size()/4);
+        memcpy(m_Q.data(), quadIndices.data(), sizeof(uint32_t)*quadIndices.size());
+
         m_V.resize(3, vertices.size());
         for (uint32_t i=0; i<vertices.size(); ++i)
             m_V.col(i) = positions.at(vertices[i].p-1);
@@ -123,12 +156,16 @@ public:
                 m_UV.col(i) = texcoords.at(vertices[i].uv-1);
         }
 
-        m_name = filename.str();
-        cout << "done. (V=" << m_V.cols() << ", F=" << m_F.cols() << ", took "
-             << timer.elapsedString() << " and "
-             << memString(m_F.size() * sizeof(uint32_t) +
-                          sizeof(float) * (m_V.size() + m_N.size() + m_UV.size()))
-             << ")" << endl;
+        if (optimizeMesh)
+            optimize();
+
+        storeInCache(cacheKey);
+
+        logMessage(tfm::format("Loading \"%s\" .. done. (V=%i, F=%i, Q=%i, took %s and %s)",
+            filename, getVertexCount(), getTriangleCount(), getQuadCount(), timer.elapsedString(),
+            memString((getIndices().size() + getQuadIndices().size()) * sizeof(uint32_t) +
+                      sizeof(float) * (getVertexPositions().size() + getVertexNormals().size() +
+                                       getVertexTexCoords().size()))));
     }
 
 protected:
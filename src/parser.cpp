@@ -20,12 +20,14 @@
 #include <nori/proplist.h>
 #include <Eigen/Geometry>
 #include <pugixml.hpp>
+#include <tbb/task_group.h>
 #include <fstream>
+#include <deque>
 #include <set>
 
 NORI_NAMESPACE_BEGIN
 
-NoriObject *loadFromXML(const std::string &filename) {
+NoriObject *loadFromXML(const std::string &filename, bool parallel) {
     /* Load the XML file using 'pugi' (a tiny self-contained XML parser implemented in C++) */
     pugi::xml_document doc;
     pugi::xml_parse_result result = doc.load_file(filename.c_str());
@@ -129,9 +131,44 @@ NoriObject *loadFromXML(const std::string &filename) {
 
     Eigen::Affine3f transform;
 
-    /* Helper function to parse a Nori XML node (recursive) */
-    std::function<NoriObject *(pugi::xml_node &, PropertyList &, int)> parseTag = [&](
-        pugi::xml_node &node, PropertyList &list, int parentTag) -> NoriObject * {
+    /* Helper function to instantiate, populate and activate an object */
+    auto createObject = [&](const pugi::xml_node &node, int tag, const PropertyList &propList,
+                            const std::vector<NoriObject *> &children) -> NoriObject * {
+        /* This is an object, first instantiate it */
+        NoriObject *result = NoriObjectFactory::createInstance(
+            node.attribute("type").value(),
+            propList
+        );
+
+        if (result->getClassType() != (int) tag) {
+            throw NoriException(
+                "Unexpectedly constructed an object "
+                "of type <%s> (expected type <%s>): %s",
+                NoriObject::classTypeName(result->getClassType()),
+                NoriObject::classTypeName((NoriObject::EClassType) tag),
+                result->toString());
+        }
+
+        /* Add all children */
+        for (auto ch: children) {
+            result->addChild(ch);
+            ch->setParent(result);
+        }
+
+        /* Activate / configure the object */
+        result->activate();
+        return result;
+    };
+
+    /* Meshes that are being loaded in parallel */
+    tbb::task_group tasks;
+    size_t deferredCount = 0;
+
+    /* Helper function to parse a Nori XML node (recursive). Meshes may be
+       created asynchronously, in which case the function returns \c nullptr
+       and the object is later written to \c slot (if provided) */
+    std::function<NoriObject *(pugi::xml_node &, PropertyList &, int, NoriObject **)> parseTag = [&](
+        pugi::xml_node &node, PropertyList &list, int parentTag, NoriObject **slot) -> NoriObject * {
         /* Skip over comments */
         if (node.type() == pugi::node_comment || node.type() == pugi::node_declaration)
             return nullptr;
@@ -173,42 +210,62 @@ NoriObject *loadFromXML(const std::string &filename) {
         else if (tag == ETransform)
             transform.setIdentity();
 
+        /* Child slots are kept in document order. A deque is used so that
+           references to existing slots remain valid while it grows */
         PropertyList propList;
-        std::vector<NoriObject *> children;
-        for (pugi::xml_node &ch: node.children()) {
-            NoriObject *child = parseTag(ch, propList, tag);
-            if (child)
-                children.push_back(child);
+        std::deque<NoriObject *> slots;
+        size_t deferredBefore = deferredCount;
+        try {
+            for (pugi::xml_node &ch: node.children()) {
+                slots.push_back(nullptr);
+                NoriObject *child = parseTag(ch, propList, tag, &slots.back());
+                if (child)
+                    slots.back() = child;
+            }
+        } catch (...) {
+            /* Pending meshes write to 'slots', which is about to go out of
+               scope. Let them finish and report the first error instead */
+            if (deferredCount != deferredBefore) {
+                try {
+                    tasks.wait();
+                } catch (...) { }
+            }
+            throw;
         }
 
+        /* Wait for child meshes that are still being loaded */
+        if (deferredCount != deferredBefore)
+            tasks.wait();
+
         NoriObject *result = nullptr;
         try {
             if (currentIsObject) {
                 check_attributes(node, { "type" });
 
-                /* This is an object, first instantiate it */
-                result = NoriObjectFactory::createInstance(
-                    node.attribute("type").value(),
-                    propList
-                );
-
-                if (result->getClassType() != (int) tag) {
-                    throw NoriException(
-                        "Unexpectedly constructed an object "
-                        "of type <%s> (expected type <%s>): %s",
-                        NoriObject::classTypeName(result->getClassType()),
-                        NoriObject::classTypeName((NoriObject::EClassType) tag),
-                        result->toString());
+                if (parallel && tag == EMesh && slot) {
+                    /* Load the mesh in the background; its children (BSDF,
+                       emitter, ..) have already been created at this point */
+                    std::vector<NoriObject *> children(slots.begin(), slots.end());
+                    children.erase(std::remove(children.begin(), children.end(), nullptr), children.end());
+                    tasks.run([&, node, tag, propList, children, slot] {
+                        try {
+                            *slot = createObject(node, tag, propList, children);
+                        } catch (const NoriException &e) {
+                            throw NoriException("Error while parsing \"%s\": %s (at %s)", filename,
+                                                e.what(), offset(node.offset_debug()));
+                        }
+                    });
+                    deferredCount++;
+                    return nullptr;
                 }
 
-                /* Add all children */
-                for (auto ch: children) {
-                    result->addChild(ch);
-                    ch->setParent(result);
+                std::vector<NoriObject *> children;
+                for (auto ch: slots) {
+                    if (ch)
+                        children.push_back(ch);
                 }
 
-                /* Activate / configure the object */
-                result->activate();
+                result = createObject(node, tag, propList, children);
             } else {
                 /* This is a property */
                 switch (tag) {
@@ -313,7 +370,7 @@ NoriObject *loadFromXML(const std::string &filename) {
     };
 
     PropertyList list;
-    return parseTag(*doc.begin(), list, EInvalid);
+    return parseTag(*doc.begin(), list, EInvalid, nullptr);
 }
 
 NORI_NAMESPACE_END
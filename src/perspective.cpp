@@ -35,7 +35,6 @@ public:
         /* Width and height in pixels. Default: 720p */
         m_outputSize.x() = propList.getInteger("width", 1280);
         m_outputSize.y() = propList.getInteger("height", 720);
-        m_invOutputSize = m_outputSize.cast<float>().cwiseInverse();
 
         /* Specifies an optional camera-to-world transformation. Default: none */
         m_cameraToWorld = propList.getTransform("toWorld", Transform());
@@ -52,6 +51,7 @@ public:
 
     void activate() {
         float aspect = m_outputSize.x() / (float) m_outputSize.y();
+        m_invOutputSize = m_outputSize.cast<float>().cwiseInverse();
 
         /* Project vectors in camera space onto a plane at z=1:
          *
@@ -0,0 +1,286 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/sampler.h>
+#include <nori/hash.h>
+#include <nori/bluenoise.h>
+#include <nori/timer.h>
+#include <pcg32.h>
+
+NORI_NAMESPACE_BEGIN
+
+/// Number of points of each precomputed PMJ02 sequence
+#define NORI_PMJ02_SIZE_LOG2 10
+
+/// Number of independently generated PMJ02 sequences
+#define NORI_PMJ02_TABLES 32
+
+/**
+ * \brief Generates progressive multi-jittered (0, 2) sequences
+ *
+ * Implements the construction by Christensen et al. ("Progressive
+ * Multi-Jittered Sample Sequences", EGSR 2018). The sequence is extended
+ * by doubling the number of points, placing each new point in an empty
+ * subquadrant of the cell that contains an existing point. Among the
+ * positions that keep every elementary interval occupied by at most one
+ * point, one is chosen at random, so that every power-of-two prefix of
+ * the sequence is a (0, 2)-net.
+ *
+ * Points are stored as 32-bit binary fractions.
+ */
+class PMJ02Generator {
+public:
+    PMJ02Generator(uint32_t seed) {
+        /* Separate streams, consecutive seeds would give shifted copies */
+        m_random.seed(hashInt(seed), seed);
+    }
+
+    /// Generate a sequence with <tt>2^log2Count</tt> points
+    std::vector<std::pair<uint32_t, uint32_t>> generate(int log2Count) {
+        m_points.clear();
+        m_points.emplace_back(m_random.nextUInt(), m_random.nextUInt());
+
+        for (int m = 1; m <= log2Count; ++m) {
+            /* Retry with different random choices in the (rare) case
+               that the greedy placement runs out of valid positions */
+            while (!extend(m))
+                m_points.resize((size_t) 1 << (m - 1));
+        }
+        return m_points;
+    }
+
+protected:
+    /// Double the number of points to 2^m
+    bool extend(int m) {
+        uint32_t count = 1u << (m - 1);
+
+        /* Mark the elementary intervals of all shapes (2^a x 2^(m-a))
+           that are occupied by the existing points */
+        m_occupied.assign((size_t) (m + 1) << m, false);
+        m_log2Count = m;
+        for (const auto &p : m_points)
+            mark(p.first >> (32 - m), p.second >> (32 - m));
+
+        if (m % 2 == 1) {
+            /* Even extension: the cells of a 2^k x 2^k grid contain one point
+               each, the new one goes into the diagonally opposite subquadrant */
+            int k = (m - 1) / 2;
+            for (uint32_t s = 0; s < count; ++s) {
+                uint32_t qx = m_points[s].first >> (31 - k), qy = m_points[s].second >> (31 - k);
+                if (!place(qx ^ 1, qy ^ 1, k + 1))
+                    return false;
+            }
+        } else {
+            /* Odd extension: the cells of a 2^k x 2^k grid contain two points
+               in diagonally opposite subquadrants. The two new points are
+               placed in the other two subquadrants in random order */
+            int k = (m - 2) / 2;
+            uint32_t half = count / 2;
+            std::vector<std::pair<uint32_t, uint32_t>> second(half);
+            for (uint32_t s = 0; s < half; ++s) {
+                uint32_t qx = m_points[s].first >> (31 - k), qy = m_points[s].second >> (31 - k);
+                bool flipX = m_random.nextUInt() & 1;
+                second[s] = flipX ? std::make_pair(qx, qy ^ 1) : std::make_pair(qx ^ 1, qy);
+                if (!place(flipX ? qx ^ 1 : qx, flipX ? qy : qy ^ 1, k + 1))
+                    return false;
+            }
+            for (uint32_t s = 0; s < half; ++s) {
+                if (!place(second[s].first, second[s].second, k + 1))
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    /// Index of the elementary interval of shape \c a containing the given strata
+    uint32_t interval(int a, uint32_t cx, uint32_t cy) const {
+        int m = m_log2Count;
+        return ((uint32_t) a << m) | ((cx >> (m - a)) << (m - a)) | (cy >> a);
+    }
+
+    bool isFree(uint32_t cx, uint32_t cy) const {
+        for (int a = 0; a <= m_log2Count; ++a)
+            if (m_occupied[interval(a, cx, cy)])
+                return false;
+        return true;
+    }
+
+    void mark(uint32_t cx, uint32_t cy) {
+        for (int a = 0; a <= m_log2Count; ++a)
+            m_occupied[interval(a, cx, cy)] = true;
+    }
+
+    /**
+     * \brief Add a point within the given cell of a <tt>2^bits x 2^bits</tt>
+     * grid at a random valid position
+     */
+    bool place(uint32_t qx, uint32_t qy, int bits) {
+        int m = m_log2Count, shift = m - bits;
+
+        m_candidates.clear();
+        for (uint32_t i = 0; i < (1u << shift); ++i) {
+            for (uint32_t j = 0; j < (1u << shift); ++j) {
+                uint32_t cx = (qx << shift) | i, cy = (qy << shift) | j;
+                if (isFree(cx, cy))
+                    m_candidates.emplace_back(cx, cy);
+            }
+        }
+        if (m_candidates.empty())
+            return false;
+
+        auto c = m_candidates[m_random.nextUInt((uint32_t) m_candidates.size())];
+        mark(c.first, c.second);
+
+        /* Jitter the point within its stratum */
+        uint32_t mask = m < 32 ? (0xFFFFFFFFu >> m) : 0u;
+        m_points.emplace_back((c.first << (32 - m)) | (m_random.nextUInt() & mask),
+                              (c.second << (32 - m)) | (m_random.nextUInt() & mask));
+        return true;
+    }
+
+private:
+    pcg32 m_random;
+    int m_log2Count = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> m_points;
+    std::vector<std::pair<uint32_t, uint32_t>> m_candidates;
+    std::vector<bool> m_occupied;
+};
+
+/**
+ * \brief Progressive multi-jittered (0, 2) sampler
+ *
+ * Draws samples from a set of PMJ02 sequences that are generated once per
+ * process (when the first instance is created). Unlike Sobol points,
+ * they are well stratified at every sample count and not just at powers
+ * of two, which suits progressive and adaptive rendering.
+ *
+ * Every 1D or 2D request consumes one dimension (pair). The dimensions
+ * of a pixel are padded by drawing them from different sequences, starting
+ * at a sequence chosen by hashing the pixel coordinates and the \c seed
+ * property. The points are additionally Owen-scrambled with per-pixel and
+ * per-dimension seeds, which preserves their stratification. Indexing the
+ * sequence with the pixel's sample index makes every (progressive or
+ * adaptive) pass continue the sequence of earlier ones; indices beyond
+ * the length of a sequence continue with the next one.
+ *
+ * The \c blueNoise property makes all pixels use the same sequences and
+ * decorrelates them with a blue noise dither mask instead (see \ref
+ * getBlueNoiseMask()), which distributes the error of low sample count
+ * renders as blue noise.
+ */
+class PMJ02 : public Sampler {
+public:
+    PMJ02(const PropertyList &propList) {
+        m_sampleCount = (size_t) propList.getInteger("sampleCount", 1);
+        m_seed = (uint32_t) propList.getInteger("seed", 0);
+        m_blueNoise = propList.getBoolean("blueNoise", false);
+        m_tables = getTables();
+    }
+
+    std::unique_ptr<Sampler> clone() const {
+        std::unique_ptr<PMJ02> cloned(new PMJ02());
+        cloned->m_sampleCount = m_sampleCount;
+        cloned->m_seed = m_seed;
+        cloned->m_blueNoise = m_blueNoise;
+        cloned->m_tables = m_tables;
+        return std::move(cloned);
+    }
+
+    void prepare(const ImageBlock &, uint32_t) { /* No-op for this sampler */ }
+
+    void generate(const Point2i &pixel, uint32_t sampleIndex) {
+        /* With blue noise dithering, all pixels share the same sequence
+           and are decorrelated by the dither mask instead */
+        m_pixel = pixel;
+        m_pixelSeed = m_blueNoise ? hashInt(m_seed)
+            : hashCombine(hashCombine(m_seed, (uint32_t) pixel.x()), (uint32_t) pixel.y());
+        m_sampleIndex = sampleIndex;
+        m_dimension = m_firstDimension = 0;
+    }
+
+    void advance() {
+        m_sampleIndex++;
+        m_dimension = m_firstDimension;
+    }
+
+    float next1D() {
+        /* The projections of (0, 2)-sequences are (0, 1)-sequences */
+        return next2D().x();
+    }
+
+    Point2f next2D() {
+        const uint32_t size = 1u << NORI_PMJ02_SIZE_LOG2;
+        uint32_t table = (m_pixelSeed + m_dimension + m_sampleIndex / size) % NORI_PMJ02_TABLES;
+        const auto &p = (*m_tables)[table][m_sampleIndex % size];
+
+        uint32_t dimension = m_dimension++;
+        uint32_t seedX = hashCombine(m_pixelSeed, dimension), seedY = hashInt(seedX);
+        return Point2f(
+            fractionToFloat(dither(nestedUniformScramble(p.first, seedX), 2 * dimension)),
+            fractionToFloat(dither(nestedUniformScramble(p.second, seedY), 2 * dimension + 1))
+        );
+    }
+
+    std::string toString() const {
+        return tfm::format("PMJ02[sampleCount=%i, seed=%i, blueNoise=%s]",
+                           m_sampleCount, m_seed, m_blueNoise ? "true" : "false");
+    }
+
+protected:
+    PMJ02() { }
+
+    void rewind(uint32_t count, uint32_t dimension) {
+        m_sampleIndex -= count;
+        m_dimension = m_firstDimension = dimension;
+    }
+
+    typedef std::vector<std::vector<std::pair<uint32_t, uint32_t>>> Tables;
+
+    /// Return the precomputed sequences (generated on the first call)
+    static const Tables *getTables() {
+        static Tables tables = [] {
+            cout << "Generating PMJ02 sequences .. ";
+            cout.flush();
+            Timer timer;
+            Tables result;
+            for (int i = 0; i < NORI_PMJ02_TABLES; ++i)
+                result.push_back(PMJ02Generator(i).generate(NORI_PMJ02_SIZE_LOG2));
+            cout << "done. (took " << timer.elapsedString() << ")" << endl;
+            return result;
+        }();
+        return &tables;
+    }
+
+    /// Apply the blue noise dither mask (if enabled) to a sample component
+    uint32_t dither(uint32_t value, uint32_t component) const {
+        return m_blueNoise ? value ^ getBlueNoiseMask(m_pixel, component) : value;
+    }
+
+private:
+    const Tables *m_tables = nullptr;
+    uint32_t m_seed = 0;
+    bool m_blueNoise = false;
+    Point2i m_pixel = Point2i::Zero();
+    uint32_t m_pixelSeed = 0;
+    uint32_t m_sampleIndex = 0;
+    uint32_t m_dimension = 0;
+    uint32_t m_firstDimension = 0;
+};
+
+NORI_REGISTER_CLASS(PMJ02, "pmj02");
+NORI_NAMESPACE_END
@@ -0,0 +1,225 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/rawsamples.h>
+#include <cstring>
+
+NORI_NAMESPACE_BEGIN
+
+/// Size of a full precision record (position and radiance as floats)
+#define NORI_RAW_RECORD_SIZE 20
+
+/// Size of a quantized record (16-bit positions, RGBE radiance)
+#define NORI_RAW_QUANTIZED_RECORD_SIZE 8
+
+/// Size of the header of a chunk (cell coordinates and sample count)
+#define NORI_RAW_CHUNK_HEADER_SIZE 12
+
+static size_t recordSize(bool quantized) {
+    return quantized ? NORI_RAW_QUANTIZED_RECORD_SIZE : NORI_RAW_RECORD_SIZE;
+}
+
+/// Encode a color in Ward's shared exponent format (negative values and NaNs become zero)
+static void encodeRGBE(const Color3f &c, uint8_t *rgbe) {
+    float r = c.r() > 0 ? std::min(c.r(), 1e38f) : 0.0f,
+          g = c.g() > 0 ? std::min(c.g(), 1e38f) : 0.0f,
+          b = c.b() > 0 ? std::min(c.b(), 1e38f) : 0.0f;
+    float m = std::max(r, std::max(g, b));
+    if (m < 1e-32f) {
+        rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+        return;
+    }
+    int exponent;
+    float scale = std::frexp(m, &exponent) * 256.0f / m;
+    rgbe[0] = (uint8_t) std::min(r * scale, 255.0f);
+    rgbe[1] = (uint8_t) std::min(g * scale, 255.0f);
+    rgbe[2] = (uint8_t) std::min(b * scale, 255.0f);
+    rgbe[3] = (uint8_t) (exponent + 128);
+}
+
+static Color3f decodeRGBE(const uint8_t *rgbe) {
+    if (rgbe[3] == 0)
+        return Color3f(0.0f);
+    float scale = std::ldexp(1.0f, (int) rgbe[3] - (128 + 8));
+    return Color3f((rgbe[0] + 0.5f) * scale, (rgbe[1] + 0.5f) * scale, (rgbe[2] + 0.5f) * scale);
+}
+
+RawSampleWriter::RawSampleWriter(const std::string &filename, const Point2i &cropOffset,
+                                 const Vector2i &cropSize, int cellSize, bool quantized)
+    : m_filename(filename) {
+    if (quantized && cellSize > 256)
+        throw NoriException("RawSampleWriter: the cells are too large for quantized positions!");
+    m_os.open(filename, std::ios::binary);
+    if (m_os.fail())
+        throw NoriException("Unable to create \"%s\"!", filename);
+
+    memcpy(m_header.magic, "NRAW", 4);
+    m_header.quantized = quantized ? 1 : 0;
+    m_header.cellSize = cellSize;
+    m_header.cropOffset[0] = cropOffset.x(); m_header.cropOffset[1] = cropOffset.y();
+    m_header.cropSize[0] = cropSize.x(); m_header.cropSize[1] = cropSize.y();
+    m_os.write(reinterpret_cast<const char *>(&m_header), sizeof(RawSampleHeader));
+    m_size = sizeof(RawSampleHeader);
+}
+
+void RawSampleWriter::write(const Point2i &cell, const std::vector<RawSample> &samples) {
+    if (samples.empty())
+        return;
+
+    /* Encode the chunk before taking the lock */
+    bool quantized = m_header.quantized != 0;
+    size_t size = NORI_RAW_CHUNK_HEADER_SIZE + samples.size() * recordSize(quantized);
+    std::unique_ptr<char[]> buffer(new char[size]);
+    int32_t chunkHeader[3] = { cell.x(), cell.y(), (int32_t) samples.size() };
+    memcpy(buffer.get(), chunkHeader, NORI_RAW_CHUNK_HEADER_SIZE);
+
+    Point2f offset((float) (m_header.cropOffset[0] + cell.x() * m_header.cellSize),
+                   (float) (m_header.cropOffset[1] + cell.y() * m_header.cellSize));
+    char *ptr = buffer.get() + NORI_RAW_CHUNK_HEADER_SIZE;
+    if (quantized) {
+        /* Positions within the cell in units of cellSize / 65536 pixels */
+        float scale = 65536.0f / m_header.cellSize;
+        for (const RawSample &s : samples) {
+            uint16_t pos[2];
+            for (int i=0; i<2; ++i)
+                pos[i] = (uint16_t) std::min(std::max((s.position[i] - offset[i]) * scale, 0.0f), 65535.0f);
+            memcpy(ptr, pos, 4);
+            encodeRGBE(s.value, reinterpret_cast<uint8_t *>(ptr + 4));
+            ptr += NORI_RAW_QUANTIZED_RECORD_SIZE;
+        }
+    } else {
+        for (const RawSample &s : samples) {
+            float record[5] = { s.position.x() - offset.x(), s.position.y() - offset.y(),
+                                s.value.r(), s.value.g(), s.value.b() };
+            memcpy(ptr, record, NORI_RAW_RECORD_SIZE);
+            ptr += NORI_RAW_RECORD_SIZE;
+        }
+    }
+
+    tbb::mutex::scoped_lock lock(m_mutex);
+    m_os.write(buffer.get(), size);
+    m_sampleCount += samples.size();
+    m_size += size;
+}
+
+void RawSampleWriter::close() {
+    m_os.close();
+    if (m_os.fail())
+        throw NoriException("Unable to write \"%s\"!", m_filename);
+}
+
+RawSampleReader::RawSampleReader(const std::vector<std::string> &filenames)
+    : m_filenames(filenames) {
+    if (filenames.empty())
+        throw NoriException("RawSampleReader: no files were specified!");
+
+    for (size_t i=0; i<filenames.size(); ++i) {
+        std::ifstream is(filenames[i], std::ios::binary);
+        if (is.fail())
+            throw NoriException("Unable to open \"%s\"!", filenames[i]);
+
+        RawSampleHeader header;
+        is.read(reinterpret_cast<char *>(&header), sizeof(RawSampleHeader));
+        if (is.fail() || memcmp(header.magic, "NRAW", 4) != 0)
+            throw NoriException("\"%s\" is not a raw sample file!", filenames[i]);
+
+        if (i == 0) {
+            m_header = header;
+            if (m_header.cellSize <= 0 || m_header.cropSize[0] <= 0 || m_header.cropSize[1] <= 0)
+                throw NoriException("\"%s\" has an invalid header!", filenames[i]);
+            m_cellCount = Vector2i(
+                (m_header.cropSize[0] + m_header.cellSize - 1) / m_header.cellSize,
+                (m_header.cropSize[1] + m_header.cellSize - 1) / m_header.cellSize);
+            m_chunks.resize((size_t) m_cellCount.x() * m_cellCount.y());
+        } else if (header.cellSize != m_header.cellSize ||
+                   memcmp(header.cropOffset, m_header.cropOffset, sizeof(header.cropOffset)) != 0 ||
+                   memcmp(header.cropSize, m_header.cropSize, sizeof(header.cropSize)) != 0) {
+            throw NoriException("\"%s\" covers a different region of the image than \"%s\"!",
+                                filenames[i], filenames[0]);
+        }
+        m_quantized.push_back(header.quantized != 0);
+
+        /* Index the chunks, skipping over the records */
+        size_t size = recordSize(header.quantized != 0);
+        uint64_t position = sizeof(RawSampleHeader);
+        is.seekg(0, std::ios::end);
+        uint64_t fileSize = (uint64_t) is.tellg();
+        is.seekg(position);
+        while (position < fileSize) {
+            int32_t chunkHeader[3];
+            is.read(reinterpret_cast<char *>(chunkHeader), NORI_RAW_CHUNK_HEADER_SIZE);
+            position += NORI_RAW_CHUNK_HEADER_SIZE;
+            if (is.fail() || chunkHeader[0] < 0 || chunkHeader[0] >= m_cellCount.x() ||
+                chunkHeader[1] < 0 || chunkHeader[1] >= m_cellCount.y() || chunkHeader[2] < 0 ||
+                position + chunkHeader[2] * size > fileSize)
+                throw NoriException("\"%s\" is corrupt or truncated!", filenames[i]);
+
+            Chunk chunk = { (uint32_t) i, (uint32_t) chunkHeader[2], position };
+            m_chunks[chunkHeader[1] * m_cellCount.x() + chunkHeader[0]].push_back(chunk);
+            m_sampleCount += chunk.count;
+            position += chunk.count * size;
+            is.seekg(position);
+        }
+    }
+}
+
+void RawSampleReader::read(const Point2i &cell, std::vector<RawSample> &samples) const {
+    samples.clear();
+    Streams &streams = m_streams.local();
+    std::vector<char> &buffer = m_buffers.local();
+    if (streams.empty())
+        streams.resize(m_filenames.size());
+
+    Point2f offset((float) (m_header.cropOffset[0] + cell.x() * m_header.cellSize),
+                   (float) (m_header.cropOffset[1] + cell.y() * m_header.cellSize));
+    float scale = m_header.cellSize / 65536.0f;
+
+    for (const Chunk &chunk : m_chunks[cell.y() * m_cellCount.x() + cell.x()]) {
+        std::unique_ptr<std::ifstream> &is = streams[chunk.file];
+        if (!is)
+            is.reset(new std::ifstream(m_filenames[chunk.file], std::ios::binary));
+
+        bool quantized = m_quantized[chunk.file];
+        buffer.resize(chunk.count * recordSize(quantized));
+        is->seekg(chunk.position);
+        is->read(buffer.data(), buffer.size());
+        if (is->fail())
+            throw NoriException("Unable to read \"%s\"!", m_filenames[chunk.file]);
+
+        const char *ptr = buffer.data();
+        for (uint32_t i=0; i<chunk.count; ++i) {
+            RawSample s;
+            if (quantized) {
+                uint16_t pos[2];
+                memcpy(pos, ptr, 4);
+                s.position = offset + Vector2f((pos[0] + 0.5f) * scale, (pos[1] + 0.5f) * scale);
+                s.value = decodeRGBE(reinterpret_cast<const uint8_t *>(ptr + 4));
+                ptr += NORI_RAW_QUANTIZED_RECORD_SIZE;
+            } else {
+                float record[5];
+                memcpy(record, ptr, NORI_RAW_RECORD_SIZE);
+                s.position = offset + Vector2f(record[0], record[1]);
+                s.value = Color3f(record[2], record[3], record[4]);
+                ptr += NORI_RAW_RECORD_SIZE;
+            }
+            samples.push_back(s);
+        }
+    }
+}
+
+NORI_NAMESPACE_END
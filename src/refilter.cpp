@@ -0,0 +1,167 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/rawsamples.h>
+#include <nori/block.h>
+#include <nori/bitmap.h>
+#include <nori/rfilter.h>
+#include <nori/timer.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/task_scheduler_init.h>
+#include <memory>
+
+/**
+ * nori-refilter: reconstructs an image from the raw samples written by
+ * <tt>nori --raw-samples</tt> using any registered reconstruction filter,
+ * so that the filter can be changed without rendering the scene again.
+ *
+ * The cells of the image are filtered in parallel and merged with a
+ * \ref BlockAccumulator, which makes the result independent of the
+ * number of threads. The samples of several files (e.g. those of
+ * distributed render jobs) are combined.
+ */
+
+using namespace nori;
+
+static void printUsage(const char *name) {
+    cerr << "Syntax: " << name << " [options] <samples.raw> [<samples.raw> ...]" << endl
+         << "Options:" << endl
+         << "  --filter <type>       Reconstruction filter (default: gaussian)" << endl
+         << "  --param <name=value>  Set a parameter of the filter (e.g. radius=2)" << endl
+         << "  --compression <type>  OpenEXR compression: none, zip (default), piz or dwaa" << endl
+         << "  --half                Store half precision values in OpenEXR files" << endl
+         << "  --output <filename>   Output filename (default: <first file>_<filter type>)" << endl
+         << "  --threads <count>     Number of worker threads (default: one per core)" << endl;
+}
+
+int main(int argc, char **argv) {
+    std::vector<std::string> filenames;
+    std::string filterType = "gaussian", outputName;
+    PropertyList filterProps;
+    EXROptions exrOptions;
+    int threadCount = -1;
+
+    try {
+        for (int i=1; i<argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--half") {
+                exrOptions.half = true;
+                continue;
+            } else if (arg.compare(0, 2, "--") != 0) {
+                filenames.push_back(arg);
+                continue;
+            }
+
+            if (i + 1 >= argc)
+                throw NoriException("Missing value for option \"%s\"!", arg);
+            std::string value = argv[++i];
+
+            if (arg == "--filter") {
+                filterType = value;
+            } else if (arg == "--param") {
+                size_t pos = value.find('=');
+                if (pos == std::string::npos)
+                    throw NoriException("Expected a filter parameter of the form <name>=<value>!");
+                filterProps.setFloat(value.substr(0, pos), toFloat(value.substr(pos + 1)));
+            } else if (arg == "--compression") {
+                exrOptions.compression = EXROptions::parseCompression(value);
+            } else if (arg == "--output") {
+                outputName = value;
+            } else if (arg == "--threads") {
+                threadCount = exrOptions.threadCount = toInt(value);
+            } else {
+                throw NoriException("Unknown option \"%s\"!", arg);
+            }
+        }
+        if (filenames.empty())
+            throw NoriException("No raw sample files were specified!");
+    } catch (const std::exception &e) {
+        cerr << "Error: " << e.what() << endl;
+        printUsage(argv[0]);
+        return -1;
+    }
+
+    tbb::task_scheduler_init init(threadCount > 0 ? threadCount
+                                    : tbb::task_scheduler_init::automatic);
+
+    try {
+        std::unique_ptr<NoriObject> object(NoriObjectFactory::createInstance(filterType, filterProps));
+        if (object->getClassType() != NoriObject::EReconstructionFilter)
+            throw NoriException("\"%s\" is not a reconstruction filter!", filterType);
+        object->activate();
+        const ReconstructionFilter *filter = static_cast<const ReconstructionFilter *>(object.get());
+
+        cout << "Indexing " << filenames.size() << " raw sample file(s) .. ";
+        cout.flush();
+        Timer timer;
+        RawSampleReader reader(filenames);
+        cout << "done. (" << reader.getSampleCount() << " samples, took "
+             << timer.elapsedString() << ")" << endl;
+
+        ImageBlock result(reader.getCropSize(), filter);
+        result.setOffset(reader.getCropOffset());
+        result.clear();
+
+        /* Splat the samples cell by cell, using the cell grid of the render */
+        int cellSize = reader.getCellSize();
+        BlockScheduler scheduler(reader.getCropSize(), 2 * cellSize, reader.getCropOffset());
+        if (scheduler.getCellSize() != cellSize)
+            throw NoriException("Unsupported cell size %i!", cellSize);
+        BlockAccumulator accumulator(result, cellSize);
+        Vector2i cellCount = reader.getCellCount();
+
+        cout << "Filtering with " << filter->toString() << " .. ";
+        cout.flush();
+        timer.reset();
+        tbb::parallel_for(tbb::blocked_range<int>(0, cellCount.x() * cellCount.y()),
+            [&](const tbb::blocked_range<int> &range) {
+                ImageBlock block(Vector2i(cellSize), filter);
+                std::vector<RawSample> samples;
+                for (int i=range.begin(); i<range.end(); ++i) {
+                    Point2i cell(i % cellCount.x(), i / cellCount.x());
+                    scheduler.configure(cell, block);
+                    block.clear();
+
+                    /* Cells without samples are added as well, since the
+                       accumulator waits for all neighbors of a cell */
+                    reader.read(cell, samples);
+                    for (const RawSample &s : samples)
+                        block.put(s.position, s.value);
+                    accumulator.put(block);
+                }
+            }
+        );
+        double elapsed = timer.elapsed();
+        cout << tfm::format("done. (took %s, %.2f M samples/sec)", timeString(elapsed),
+                            reader.getSampleCount() / (elapsed * 1000.0)) << endl;
+
+        /* By default, don't overwrite the image written by the render itself */
+        std::string suffix = outputName.empty() ? "_" + filterType : "";
+        outputName = stripExtension(outputName.empty() ? filenames[0] : outputName) + suffix;
+
+        /* Normalize by the summed filter weights and save the result */
+        std::unique_ptr<Bitmap> bitmap(result.toBitmap());
+        bitmap->saveEXR(outputName, exrOptions);
+        bitmap->savePNG(outputName);
+    } catch (const std::exception &e) {
+        cerr << "Fatal error: " << e.what() << endl;
+        return -1;
+    }
+    return 0;
+}
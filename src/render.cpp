@@ -0,0 +1,918 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/render.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/block.h>
+#include <nori/timer.h>
+#include <nori/bitmap.h>
+#include <nori/sampler.h>
+#include <nori/integrator.h>
+#if defined(NORI_BUILD_GUI)
+#include <nori/gui.h>
+#endif
+#include <nori/numa.h>
+#include <nori/mesh.h>
+#include <nori/rawsamples.h>
+#include <tbb/parallel_for.h>
+#include <tbb/task_scheduler_init.h>
+#include <tbb/task_arena.h>
+#include <condition_variable>
+#include <functional>
+#include <fstream>
+#include <sstream>
+#include <atomic>
+#include <thread>
+#include <cstring>
+#include <cstdio>
+
+/// Number of passes of a checkpointed render when no pass size is specified
+#define NORI_CHECKPOINT_PASSES 16
+
+/// Spacing of the pixels that are sampled to estimate the cost of a cell
+#define NORI_COST_ESTIMATE_STRIDE 4
+
+NORI_NAMESPACE_BEGIN
+
+/// Number of samples that should be taken in each pixel of the image
+typedef Eigen::Array<uint32_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> SampleCountMap;
+
+/**
+ * \brief Render the pixels of an image block
+ *
+ * Takes \c sampleCount samples per pixel, or the number specified
+ * in \c counts (indexed relative to the offset of \c result) if
+ * provided. The samples of a pixel continue its sample sequence at
+ * index \c firstSample, or after the samples recorded in the moments
+ * of \c result in the adaptive case. Samples are splatted using the
+ * block's reconstruction filter, unless \c filterSampler is given. The
+ * samples are also stored in \c rawSamples if provided. Returns the total
+ * number of samples.
+ */
+static uint64_t renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block,
+                            uint32_t sampleCount, const SampleCountMap *counts,
+                            const ImageBlock &result, uint32_t firstSample,
+                            const FilterSampler *filterSampler,
+                            std::vector<RawSample> *rawSamples) {
+    const Camera *camera = scene->getCamera();
+    const Integrator *integrator = scene->getIntegrator();
+
+    Point2i offset = block.getOffset();
+    Vector2i size  = block.getSize();
+    Point2i cropOffset = result.getOffset();
+    uint64_t total = 0;
+    std::vector<Point2f> cameraSamples;
+
+    /* Clear the block contents */
+    block.clear();
+    if (rawSamples)
+        rawSamples->clear();
+
+    /* For each pixel and pixel sample sample */
+    for (int y=0; y<size.y(); ++y) {
+        for (int x=0; x<size.x(); ++x) {
+            uint32_t pixelSampleCount = counts ? counts->coeff(
+                y + offset.y() - cropOffset.y(), x + offset.x() - cropOffset.x()) : sampleCount;
+            total += pixelSampleCount;
+
+            /* Adaptive passes continue after the samples taken so far */
+            Point2i pixel(x + offset.x(), y + offset.y());
+            sampler->generate(pixel, counts ? (uint32_t) result.getMoments(
+                pixel.x() - cropOffset.x(), pixel.y() - cropOffset.y()).count : firstSample);
+
+            /* Generate the pixel and aperture samples of the pixel at once */
+            cameraSamples.resize(2 * pixelSampleCount);
+            sampler->generateBatch(pixelSampleCount, 2, cameraSamples.data());
+
+            for (uint32_t i=0; i<pixelSampleCount; ++i) {
+                Point2f pixelSample = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + cameraSamples[2*i];
+                const Point2f &apertureSample = cameraSamples[2*i + 1];
+
+                /* Distribute the sample around the pixel center according to the filter */
+                float weight = 1.0f;
+                if (filterSampler) {
+                    Vector2f filterOffset;
+                    weight = filterSampler->sample(cameraSamples[2*i], filterOffset);
+                    pixelSample = Point2f(x + offset.x() + 0.5f, y + offset.y() + 0.5f) + filterOffset;
+                }
+
+                /* Sample a ray from the camera */
+                Ray3f ray;
+                Color3f value = camera->sampleRay(ray, pixelSample, apertureSample);
+
+                /* Compute the incident radiance */
+                value *= integrator->Li(scene, sampler, ray);
+
+                /* Store in the image block */
+                if (filterSampler)
+                    block.putPixel(pixel, value, weight);
+                else
+                    block.put(pixelSample, value);
+                if (rawSamples)
+                    rawSamples->push_back({ pixelSample, value });
+
+                sampler->advance();
+            }
+        }
+    }
+
+    return total;
+}
+
+/**
+ * \brief Trace a few camera rays through an image block to estimate
+ * how expensive it is to render
+ *
+ * Takes one sample in every pixel of a grid with spacing \c stride and
+ * discards the results. Only the time taken matters.
+ */
+static void estimateBlockCost(const Scene *scene, Sampler *sampler, const ImageBlock &block, int stride) {
+    const Camera *camera = scene->getCamera();
+    const Integrator *integrator = scene->getIntegrator();
+    Point2i offset = block.getOffset();
+    Vector2i size = block.getSize();
+
+    for (int y=std::min(stride / 2, size.y() - 1); y<size.y(); y += stride) {
+        for (int x=std::min(stride / 2, size.x() - 1); x<size.x(); x += stride) {
+            Point2i pixel(x + offset.x(), y + offset.y());
+            sampler->generate(pixel, 0);
+            Point2f pixelSample = Point2f((float) pixel.x(), (float) pixel.y()) + sampler->next2D();
+            Point2f apertureSample = sampler->next2D();
+
+            Ray3f ray;
+            camera->sampleRay(ray, pixelSample, apertureSample);
+            integrator->Li(scene, sampler, ray);
+        }
+    }
+}
+
+/**
+ * \brief Estimate the relative noise of a progressive render
+ *
+ * \c even contains the passes with an even index, and \c all contains
+ * all passes (of which there must be an even number). The two halves are
+ * independent estimates of the image, so their per-pixel difference
+ * indicates the remaining error. Returns the RMS relative error.
+ */
+static float estimateNoise(const ImageBlock &all, const ImageBlock &even) {
+    int border = all.getBorderSize();
+    Vector2i size = all.getSize();
+    double sum = 0;
+
+    for (int y=0; y<size.y(); ++y) {
+        for (int x=0; x<size.x(); ++x) {
+            Color4f a = even.coeff(y + border, x + border),
+                    b = all.coeff(y + border, x + border) - a;
+            float lumA = a.divideByFilterWeight().getLuminance(),
+                  lumB = b.divideByFilterWeight().getLuminance();
+            float error = std::abs(lumA - lumB) / (lumA + lumB + 1e-3f);
+            sum += error * error;
+        }
+    }
+
+    return (float) std::sqrt(sum / ((double) size.x() * size.y()));
+}
+
+/**
+ * \brief Distribute the samples of an adaptive pass
+ *
+ * Estimates the relative error (standard error over mean luminance) of
+ * every pixel from the moments recorded so far and computes the number
+ * of additional samples needed to bring it down to \c threshold. If
+ * this exceeds \c budget, the counts are scaled down proportionally.
+ * Returns the total number of allocated samples (0 once converged).
+ */
+static uint64_t allocateSamples(const ImageBlock &result, float threshold,
+                                uint64_t budget, SampleCountMap &counts) {
+    Vector2i size = result.getSize();
+    Eigen::ArrayXXf needed(size.y(), size.x());
+    double total = 0;
+
+    for (int y=0; y<size.y(); ++y) {
+        for (int x=0; x<size.x(); ++x) {
+            const PixelMoments &m = result.getMoments(x, y);
+            float error = std::sqrt(m.getVarianceOfMean()) / (m.getMean() + 1e-3f);
+            float ratio = error / threshold;
+            needed(y, x) = ratio > 1 ? m.count * (ratio * ratio - 1) : 0.0f;
+            total += needed(y, x);
+        }
+    }
+
+    double scale = total > budget ? budget / total : 1.0;
+    uint64_t allocated = 0;
+    for (int y=0; y<size.y(); ++y) {
+        for (int x=0; x<size.x(); ++x) {
+            counts(y, x) = (uint32_t) std::ceil(needed(y, x) * scale);
+            allocated += counts(y, x);
+        }
+    }
+    return allocated;
+}
+
+/**
+ * \brief Writes checkpoints and tonemapped snapshots in the background
+ *
+ * Checkpoints are serialized into memory by the rendering thread at the
+ * end of a pass and then written to disk by a separate thread. Snapshots
+ * are taken by that thread while rendering continues: it only locks one
+ * stripe of the image at a time, like the preview window.
+ */
+class BackgroundWriter {
+public:
+    BackgroundWriter(const ImageBlock &result, const std::string &outputName, float snapshotInterval)
+        : m_result(result), m_outputName(outputName), m_snapshotInterval(snapshotInterval) {
+        m_thread = std::thread([this] { run(); });
+    }
+
+    /// Write any pending checkpoint and stop the thread
+    ~BackgroundWriter() {
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            m_stop = true;
+        }
+        m_cond.notify_all();
+        m_thread.join();
+    }
+
+    /// Queue a serialized checkpoint (replaces one that has not been written yet)
+    void submit(std::string &&checkpoint) {
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            m_checkpoint = std::move(checkpoint);
+        }
+        m_cond.notify_all();
+    }
+
+protected:
+    void run() {
+        Timer snapshotTimer;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true) {
+            auto ready = [&] { return m_stop || !m_checkpoint.empty(); };
+            if (m_snapshotInterval > 0) {
+                double wait = std::max(0.0, m_snapshotInterval * 1000 - snapshotTimer.elapsed());
+                m_cond.wait_for(lock, std::chrono::milliseconds((int64_t) wait), ready);
+            } else {
+                m_cond.wait(lock, ready);
+            }
+
+            if (!m_checkpoint.empty()) {
+                std::string checkpoint = std::move(m_checkpoint);
+                m_checkpoint.clear();
+                lock.unlock();
+                writeCheckpoint(checkpoint);
+                lock.lock();
+            }
+
+            if (m_stop)
+                break;
+
+            if (m_snapshotInterval > 0 && snapshotTimer.elapsed() >= m_snapshotInterval * 1000) {
+                lock.unlock();
+                writeSnapshot();
+                snapshotTimer.reset();
+                lock.lock();
+            }
+        }
+    }
+
+    void writeCheckpoint(const std::string &checkpoint) {
+        /* Write to a temporary file first so that a crash never
+           leaves behind a truncated checkpoint */
+        std::string path = m_outputName + ".checkpoint", tmpPath = path + ".tmp";
+        std::ofstream os(tmpPath, std::ios::binary);
+        os.write(checkpoint.data(), checkpoint.size());
+        os.close();
+        if (os.fail() || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+            cerr << "Warning: unable to write checkpoint \"" << path << "\"" << endl;
+    }
+
+    void writeSnapshot() {
+        int border = m_result.getBorderSize();
+        Vector2i size = m_result.getSize();
+        Bitmap bitmap(size);
+        for (int y=0; y<size.y(); ++y) {
+            int stripe = m_result.getStripe(y + border);
+            m_result.lockStripe(stripe);
+            for (int x=0; x<size.x(); ++x)
+                bitmap.coeffRef(y, x) = m_result.coeff(y + border, x + border).divideByFilterWeight();
+            m_result.unlockStripe(stripe);
+        }
+        bitmap.savePNG(m_outputName + "_snapshot");
+    }
+
+private:
+    const ImageBlock &m_result;
+    std::string m_outputName;
+    float m_snapshotInterval;
+    std::string m_checkpoint;
+    bool m_stop = false;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::thread m_thread;
+};
+
+/**
+ * \brief Header of a checkpoint file (followed by the result and
+ * optionally the even-pass block)
+ *
+ * The sample counts determine the passes and the sample indices used
+ * by them, so a render can only be resumed with the same settings.
+ */
+struct CheckpointHeader {
+    char magic[4];
+    uint32_t pass;
+    uint64_t samplesDone;
+    uint32_t sampleCount;
+    uint32_t passSampleCount;
+    uint32_t hasEven;
+    uint32_t reserved;  ///< Padding (always zero)
+};
+
+/**
+ * \brief Render the view of the active camera
+ *
+ * The output files are written by \c outputThread while the next view
+ * is being rendered (the thread must be joined before returning). When
+ * \c numa is given, every NUMA node renders its own share of the tiles
+ * using the threads of its arena.
+ */
+static void renderView(Scene *scene, const std::string &outputName, const RenderOptions &options,
+                       NumaArenas *numa, std::thread &outputThread) {
+    Camera *camera = scene->getCamera();
+
+    /* Apply command line overrides */
+    if (options.resolution != Vector2i::Zero()) {
+        if ((options.resolution.array() <= 0).any())
+            throw NoriException("Invalid output resolution %s!", options.resolution.toString());
+        camera->setOutputSize(options.resolution);
+        camera->activate();
+    }
+    if (options.sampleCount > 0)
+        scene->getSampler()->setSampleCount((size_t) options.sampleCount);
+
+    Vector2i outputSize = camera->getOutputSize();
+
+    /* Determine the region of the image that should be rendered */
+    Point2i cropOffset = Point2i::Zero();
+    Vector2i cropSize = outputSize;
+    if (options.cropSize != Vector2i::Zero()) {
+        cropOffset = options.cropOffset;
+        cropSize = options.cropSize;
+        if ((cropOffset.array() < 0).any() || (cropSize.array() <= 0).any() ||
+            ((cropOffset + cropSize).array() > outputSize.array()).any())
+            throw NoriException("Crop window (offset %s, size %s) does not fit into "
+                                "the output image (size %s)!", cropOffset.toString(),
+                                cropSize.toString(), outputSize.toString());
+    }
+    uint64_t pixelCount = (uint64_t) cropSize.x() * cropSize.y();
+
+    /* Split the samples into passes when rendering progressively. Adaptive
+       rendering always works in passes (default: 4 samples per pixel) */
+    bool adaptive = options.adaptiveThreshold > 0;
+    uint32_t sampleCount = (uint32_t) scene->getSampler()->getSampleCount();
+    uint32_t passSampleCount = sampleCount;
+    if (options.passSampleCount > 0)
+        passSampleCount = std::min(passSampleCount, (uint32_t) options.passSampleCount);
+    else if (adaptive)
+        passSampleCount = std::min(passSampleCount, 4u);
+    else if (options.checkpointInterval > 0 || options.resume)
+        /* Checkpoints are taken between passes (default: 16 passes) */
+        passSampleCount = (sampleCount + NORI_CHECKPOINT_PASSES - 1) / NORI_CHECKPOINT_PASSES;
+    uint32_t passCount = (sampleCount + passSampleCount - 1) / passSampleCount;
+    bool progressive = passCount > 1;
+
+    /* Distributed rendering: this process handles every passStride-th pass */
+    bool partial = options.isPartial();
+    uint32_t passStride = (uint32_t) options.passPartCount;
+    if (partial) {
+        if (options.tilePartCount < 1 || options.tilePartIndex < 0 ||
+            options.tilePartIndex >= options.tilePartCount ||
+            options.passPartCount < 1 || options.passPartIndex < 0 ||
+            options.passPartIndex >= options.passPartCount)
+            throw NoriException("Invalid tile or pass partition!");
+        if (adaptive || options.noiseThreshold > 0 || options.timeBudget > 0)
+            throw NoriException("Adaptive sampling, noise thresholds and time budgets "
+                                "cannot be used when rendering part of an image!");
+    }
+
+    /* Streaming output never holds the full image, which rules out everything
+       that needs it (preview, multiple passes, partial buffers, ..) */
+    bool streaming = options.streamingOutput;
+    if (streaming && (!options.headless || progressive || partial || options.varianceOutput ||
+                      options.checkpointInterval > 0 || options.snapshotInterval > 0 || options.resume))
+        throw NoriException("Streaming output requires a headless render in a single pass "
+                            "without variance output, checkpoints or snapshots!");
+
+    if (options.rawSamples && (options.filterSampling || options.resume))
+        throw NoriException("Raw samples cannot be written when using filter "
+                            "importance sampling or resuming a render!");
+
+    /* Create a block scheduler (i.e. a work scheduler) per NUMA node,
+       which hand out interleaved subsets of the tiles */
+    int nodeCount = numa ? numa->getNodeCount() : 1;
+    std::vector<std::unique_ptr<BlockScheduler>> schedulers;
+    uint64_t assignedPixels = 0;
+    for (int node=0; node<nodeCount; ++node) {
+        BlockScheduler *scheduler = new BlockScheduler(cropSize, NORI_BLOCK_SIZE, cropOffset);
+        if (options.tilePartCount > 1)
+            scheduler->setPartition(options.tilePartIndex, options.tilePartCount);
+        if (nodeCount > 1)
+            scheduler->setPartition(node, nodeCount);
+        assignedPixels += scheduler->getPixelCount();
+        schedulers.emplace_back(scheduler);
+    }
+    int cellSize = schedulers[0]->getCellSize();
+    int workerCount = numa ? numa->getConcurrency() : options.threadCount > 0
+        ? options.threadCount : tbb::task_scheduler_init::default_num_threads();
+
+    /* Render in an arena of that many threads, which bounds the job even
+       when the process was started with more (e.g. a render server) */
+    tbb::task_arena arena(workerCount);
+
+    /* Total number of samples taken by this process */
+    uint64_t sampleBudget = 0;
+    for (uint32_t pass = options.passPartIndex; pass < passCount; pass += passStride)
+        sampleBudget += std::min(passSampleCount, sampleCount - pass * passSampleCount) * assignedPixels;
+
+    /* Allocate memory for the entire output image and clear it (streaming
+       renders only use its offset and never accumulate into it) */
+    bool moments = adaptive || options.varianceOutput;
+    /* With filter importance sampling, the blocks need no filter (or border) */
+    std::unique_ptr<FilterSampler> filterSampler;
+    if (options.filterSampling)
+        filterSampler.reset(new FilterSampler(camera->getReconstructionFilter()));
+    const ReconstructionFilter *filter = filterSampler ? nullptr : camera->getReconstructionFilter();
+
+    ImageBlock result(streaming ? Vector2i(1, 1) : cropSize, filter);
+    result.setOffset(cropOffset);
+    result.setMomentsEnabled(moments);
+    result.clear();
+
+    /* Accumulation buffer of the even passes (for noise estimation) */
+    std::unique_ptr<ImageBlock> even;
+    if (progressive && !adaptive && options.noiseThreshold > 0) {
+        even.reset(new ImageBlock(cropSize, filter));
+        even->setOffset(cropOffset);
+        even->clear();
+    }
+
+    /* Continue from a previous checkpoint if requested */
+    uint32_t firstPass = (uint32_t) options.passPartIndex;
+    uint64_t firstSamplesDone = 0;
+    if (options.resume) {
+        std::string path = outputName + ".checkpoint";
+        std::ifstream is(path, std::ios::binary);
+        if (is.fail())
+            throw NoriException("Unable to open checkpoint \"%s\"!", path);
+        CheckpointHeader header;
+        is.read(reinterpret_cast<char *>(&header), sizeof(header));
+        if (is.fail() || memcmp(header.magic, "NCKP", 4) != 0)
+            throw NoriException("\"%s\" is not a valid checkpoint!", path);
+        if (header.sampleCount != sampleCount || header.passSampleCount != passSampleCount)
+            throw NoriException("Checkpoint \"%s\" was rendered with %i samples per pixel in passes of %i, "
+                                "but the current settings are %i in passes of %i!", path, header.sampleCount,
+                                header.passSampleCount, sampleCount, passSampleCount);
+        result.load(is);
+        if (result.getOffset() != cropOffset || result.getSize() != cropSize || result.hasMoments() != moments)
+            throw NoriException("Checkpoint \"%s\" does not match the current image settings!", path);
+        if (header.hasEven && even)
+            even->load(is);
+        else if (even)
+            throw NoriException("Checkpoint \"%s\" does not contain noise estimation data!", path);
+        firstPass = header.pass;
+        firstSamplesDone = header.samplesDone;
+        cout << "Resuming from pass " << firstPass << " ("
+             << tfm::format("%.1f", firstSamplesDone / (double) assignedPixels) << " spp)" << endl;
+    }
+
+    /* Merges finished blocks into the result without a global lock. When
+       rendering part of the tiles, it must not wait for the others */
+    BlockAccumulator accumulator(result, cellSize);
+    if (options.tilePartCount > 1) {
+        std::vector<bool> scheduled;
+        for (const auto &scheduler : schedulers)
+            scheduler->markScheduledCells(scheduled);
+        accumulator.setScheduled(scheduled);
+    }
+
+    /* Serializes the render state (called between passes) */
+    auto makeCheckpoint = [&](uint32_t pass, uint64_t samples) {
+        std::ostringstream os;
+        CheckpointHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "NCKP", 4);
+        header.pass = pass;
+        header.samplesDone = samples;
+        header.sampleCount = sampleCount;
+        header.passSampleCount = passSampleCount;
+        header.hasEven = even ? 1 : 0;
+        os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        result.save(os);
+        if (even)
+            even->save(os);
+        return os.str();
+    };
+
+    /* Writes checkpoints and snapshots without blocking the rendering threads */
+    std::unique_ptr<BackgroundWriter> writer;
+    if (options.checkpointInterval > 0 || options.snapshotInterval > 0)
+        writer.reset(new BackgroundWriter(result, outputName, options.snapshotInterval));
+
+    /* Normalizes finished blocks and writes them to a tiled EXR file */
+    std::unique_ptr<TiledEXRWriter> tiledWriter;
+    std::unique_ptr<StreamingAccumulator> streamer;
+    if (streaming) {
+        tiledWriter.reset(new TiledEXRWriter(outputName, cropSize, options.exrOptions));
+        streamer.reset(new StreamingAccumulator(cropSize, cropOffset, cellSize, filter,
+            [&](const Point2i &cell, const Bitmap &pixels) { tiledWriter->put(cell * cellSize, pixels); }));
+    }
+
+    /* Streams the samples to disk for refiltering with nori-refilter */
+    std::unique_ptr<RawSampleWriter> rawWriter;
+    if (options.rawSamples)
+        rawWriter.reset(new RawSampleWriter(outputName + ".raw", cropOffset, cropSize,
+                                            cellSize, options.rawQuantization));
+
+    /* Per-pixel sample counts of adaptive passes */
+    SampleCountMap counts;
+    if (adaptive)
+        counts.resize(cropSize.y(), cropSize.x());
+
+#if defined(NORI_BUILD_GUI)
+    /* Create a window that visualizes the partially rendered result */
+    NoriScreen *screen = nullptr;
+    if (!options.headless) {
+        nanogui::init();
+        screen = new NoriScreen(result);
+    }
+#else
+    if (!options.headless)
+        throw NoriException("Nori was built without a graphical user interface, use --headless!");
+#endif
+
+    /* Rendering progress, used for status reports in headless mode */
+    std::atomic<uint64_t> samplesDone(firstSamplesDone);
+    std::atomic<uint32_t> currentPass(firstPass);
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool finished = false;
+    Timer timer;
+
+    /* Do the following in parallel and asynchronously */
+    std::thread render_thread([&] {
+        if (!options.headless) {
+            cout << "Rendering .. ";
+            cout.flush();
+        }
+
+        /* Run a function on every worker, with the threads of each node
+           requesting work from the node's scheduler */
+        auto dispatch = [&](const std::function<void(int, BlockScheduler &)> &map) {
+            if (numa) {
+                /* Each node renders its tiles with the threads of its arena */
+                numa->execute([&](int node) {
+                    int firstWorker = 0;
+                    for (int i=0; i<node; ++i)
+                        firstWorker += numa->getConcurrency(i);
+                    tbb::parallel_for(0, numa->getConcurrency(node), [&](int i) {
+                        map(firstWorker + i, *schedulers[node]);
+                    });
+                });
+            } else {
+                /// Default: parallel rendering
+                arena.execute([&] {
+                    tbb::parallel_for(0, workerCount, [&](int worker) {
+                        map(worker, *schedulers[0]);
+                    });
+                });
+            }
+        };
+
+        /* The cost-aware schedule needs the cost of every cell, which is
+           otherwise only known after a pass. Estimate it with a cheap
+           pre-pass, so that the first pass (and thus a single-pass render)
+           also dispatches the most expensive tiles first. Streaming renders
+           keep the spiral order, which bounds the number of blocks in memory */
+        if (!options.spiralScheduling && !streaming) {
+            for (int node=0; node<nodeCount; ++node)
+                schedulers[node]->reset(false, numa ? numa->getConcurrency(node) : workerCount);
+            dispatch([&](int, BlockScheduler &scheduler) {
+                ImageBlock block(Vector2i(cellSize), filter);
+                std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+                BoundingBox2i cells;
+                while (scheduler.next(cells)) {
+                    for (int y=cells.min.y(); y<=cells.max.y(); ++y) {
+                        for (int x=cells.min.x(); x<=cells.max.x(); ++x) {
+                            auto start = std::chrono::steady_clock::now();
+                            scheduler.configure(Point2i(x, y), block);
+                            sampler->prepare(block, firstPass);
+                            estimateBlockCost(scene, sampler.get(), block, NORI_COST_ESTIMATE_STRIDE);
+                            scheduler.setCost(Point2i(x, y), std::chrono::duration<double>(
+                                std::chrono::steady_clock::now() - start).count());
+                        }
+                    }
+                }
+            });
+        }
+
+        uint32_t pass = firstPass;
+        float noise = -1;
+        double tailIdle = 0, workerTime = 0;
+        Timer checkpointTimer;
+        for (; samplesDone < sampleBudget; pass += passStride) {
+            currentPass = pass;
+            uint64_t remaining = sampleBudget - samplesDone;
+            uint32_t passSamples = (uint32_t) std::min((uint64_t) passSampleCount, remaining / assignedPixels);
+
+            /* Distribute the samples of adaptive passes after the first one */
+            bool adaptivePass = adaptive && pass > 0;
+            if (adaptivePass && allocateSamples(result, options.adaptiveThreshold,
+                    std::min((uint64_t) passSampleCount * pixelCount, remaining), counts) == 0)
+                break;
+
+            Timer passTimer;
+            accumulator.reset(even && pass % 2 == 0 ? even.get() : nullptr);
+            for (int node=0; node<nodeCount; ++node)
+                schedulers[node]->reset(!options.spiralScheduling,
+                    numa ? numa->getConcurrency(node) : workerCount);
+
+            typedef std::chrono::steady_clock Clock;
+            std::vector<Clock::time_point> workerEnd(workerCount);
+            Clock::time_point passStart = Clock::now();
+
+            auto map = [&](int worker, BlockScheduler &scheduler) {
+                /* Allocate memory for a small image block to be rendered
+                   by the current thread */
+                ImageBlock block(Vector2i(cellSize), filter);
+                block.setMomentsEnabled(moments);
+
+                /* Create a clone of the sampler for the current thread */
+                std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+                std::vector<RawSample> rawSamples;
+
+                /* Request cells from the scheduler until there are none left */
+                BoundingBox2i cells;
+                while (scheduler.next(cells)) {
+                    for (int y=cells.min.y(); y<=cells.max.y(); ++y) {
+                        for (int x=cells.min.x(); x<=cells.max.x(); ++x) {
+                            Clock::time_point start = Clock::now();
+                            scheduler.configure(Point2i(x, y), block);
+
+                            /* Inform the sampler about the block to be rendered */
+                            sampler->prepare(block, pass);
+
+                            /* Render all contained pixels */
+                            uint64_t samples = renderBlock(scene, sampler.get(), block, passSamples,
+                                                           adaptivePass ? &counts : nullptr, result,
+                                                           pass * passSampleCount, filterSampler.get(),
+                                                           rawWriter ? &rawSamples : nullptr);
+
+                            /* The image block has been processed. Now add it to
+                               the "big" block that represents the entire image */
+                            if (streamer)
+                                streamer->put(block);
+                            else
+                                accumulator.put(block);
+                            if (rawWriter)
+                                rawWriter->write(Point2i(x, y), rawSamples);
+                            samplesDone += samples;
+
+                            scheduler.setCost(Point2i(x, y),
+                                std::chrono::duration<double>(Clock::now() - start).count());
+                        }
+                    }
+                }
+
+                workerEnd[worker] = Clock::now();
+            };
+
+            /// Uncomment the following line for single threaded rendering
+            // map(0, *schedulers[0]);
+
+            dispatch(map);
+
+            /* Measure how long workers sat idle at the end of the pass */
+            Clock::time_point passEnd = Clock::now();
+            for (int i=0; i<workerCount; ++i)
+                tailIdle += std::chrono::duration<double>(passEnd - workerEnd[i]).count();
+            workerTime += workerCount * std::chrono::duration<double>(passEnd - passStart).count();
+
+            /* Periodically save the state after a completed pass */
+            if (options.checkpointInterval > 0 &&
+                checkpointTimer.elapsed() >= options.checkpointInterval * 1000) {
+                writer->submit(makeCheckpoint(pass + passStride, samplesDone));
+                checkpointTimer.reset();
+            }
+
+            /* Stop once the sample budget is exhausted .. */
+            if (samplesDone >= sampleBudget || (!adaptive && pass + passStride >= passCount)) {
+                pass += passStride;
+                break;
+            }
+
+            /* .. or if the next pass would exceed the time budget .. */
+            if (options.timeBudget > 0 &&
+                timer.elapsed() + passTimer.elapsed() > options.timeBudget * 1000) {
+                ++pass;
+                break;
+            }
+
+            /* .. or if the image is already sufficiently converged */
+            if (even && pass % 2 == 1 && passSamples == passSampleCount) {
+                noise = estimateNoise(result, *even);
+                if (noise < options.noiseThreshold) {
+                    ++pass;
+                    break;
+                }
+            }
+        }
+
+        /* Save the final state (e.g. to continue a render that ran out of time) */
+        if (options.checkpointInterval > 0)
+            writer->submit(makeCheckpoint(pass, samplesDone));
+
+        cout << (options.headless ? "Rendering .. " : "") << "done. (";
+        if (progressive)
+            cout << (pass - firstPass) / passStride << " passes, " << tfm::format("%.1f", samplesDone / (double) assignedPixels) << " spp, ";
+        if (noise >= 0)
+            cout << "noise estimate " << noise << ", ";
+        if (workerTime > 0)
+            cout << tfm::format("%.1f%% tail idle, ", 100 * tailIdle / workerTime);
+        cout << "took " << timer.elapsedString() << ")" << endl;
+
+        std::lock_guard<std::mutex> guard(mutex);
+        finished = true;
+        cond.notify_all();
+    });
+
+    if (options.headless) {
+        /* Periodically report the progress until rendering has finished */
+        auto interval = std::chrono::milliseconds((int64_t) (options.progressInterval * 1000));
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!cond.wait_for(lock, interval, [&] { return finished; })) {
+            uint64_t done = samplesDone;
+            double elapsed = timer.elapsed();
+            cout << tfm::format("Rendering .. %.1f%% (", 100.0 * done / sampleBudget);
+            if (progressive) {
+                cout << "pass " << currentPass + 1;
+                if (!adaptive)
+                    cout << "/" << passCount;
+                cout << ", ";
+            }
+            cout << timeString(elapsed) << " elapsed";
+            if (done > 0)
+                cout << ", ~" << timeString(elapsed * (sampleBudget - done) / done) << " remaining";
+            cout << ")" << endl;
+        }
+    } else {
+#if defined(NORI_BUILD_GUI)
+        /* Enter the application main loop */
+        nanogui::mainloop();
+#endif
+    }
+
+    /* Shut down the user interface */
+    render_thread.join();
+    writer.reset();
+
+#if defined(NORI_BUILD_GUI)
+    if (screen) {
+        delete screen;
+        nanogui::shutdown();
+    }
+#endif
+
+    if (rawWriter) {
+        rawWriter->close();
+        cout << "Wrote " << rawWriter->getSampleCount() << " raw samples ("
+             << memString(rawWriter->getSize()) << ") to \"" << outputName << ".raw\"" << endl;
+    }
+
+    if (streamer) {
+        cout << "Streamed the image using at most " << memString(streamer->getPeakMemory())
+             << " of block storage (full image: " << memString(sizeof(Color4f) *
+                (size_t) (cropSize.x() + 2 * result.getBorderSize()) *
+                (size_t) (cropSize.y() + 2 * result.getBorderSize())) << ")" << endl;
+        tiledWriter->close();
+        return;
+    }
+
+    /* Partial renders store the unnormalized buffer for nori-merge */
+    if (partial) {
+        std::string path = outputName + ".partial";
+        cout << "Writing a partial buffer to \"" << path << "\" .. ";
+        cout.flush();
+        std::ofstream os(path, std::ios::binary);
+        result.save(os);
+        os.close();
+        if (os.fail())
+            throw NoriException("Unable to write \"%s\"!", path);
+        cout << "done." << endl;
+        return;
+    }
+
+    /* Now turn the rendered image block into
+       a properly normalized bitmap */
+    std::shared_ptr<Bitmap> bitmap(result.toBitmap()), variance;
+    if (options.varianceOutput)
+        variance.reset(result.toVarianceBitmap());
+
+    /* Write the files in the background, overlapping with the next view */
+    if (outputThread.joinable())
+        outputThread.join();
+    EXROptions exrOptions = options.exrOptions;
+    exrOptions.threadCount = options.threadCount;
+    outputThread = std::thread([bitmap, variance, outputName, exrOptions] {
+        try {
+            /* Save using the OpenEXR format */
+            bitmap->saveEXR(outputName, exrOptions);
+
+            /* Save tonemapped (sRGB) output using the PNG format */
+            bitmap->savePNG(outputName);
+
+            /* Save the per-pixel variance estimates if requested */
+            if (variance)
+                variance->saveEXR(outputName + "_variance", exrOptions);
+        } catch (const std::exception &e) {
+            cerr << "Error: unable to write \"" << outputName << "\": " << e.what() << endl;
+        }
+    });
+}
+
+void render(Scene *scene, const std::string &filename, const RenderOptions &options) {
+    /* Determine the base name of the output files */
+    std::string baseName = stripExtension(options.outputName.empty() ? filename : options.outputName);
+
+    scene->getIntegrator()->preprocess(scene);
+
+    /* Create one arena of pinned threads per NUMA node if requested */
+    std::unique_ptr<NumaArenas> numa;
+    if (options.numa) {
+        numa.reset(new NumaArenas(options.threadCount > 0 ? options.threadCount
+            : tbb::task_scheduler_init::default_num_threads()));
+        cout << "Rendering with " << numa->toString() << endl;
+
+        /* Copy the mesh data into the local memory of every node */
+        if (options.numaReplication && numa->getNodeCount() > 1) {
+            const std::vector<Mesh *> &meshes = scene->getMeshes();
+            for (Mesh *mesh : meshes)
+                mesh->setReplicaCount(numa->getNodeCount());
+            std::vector<size_t> replicated(numa->getNodeCount(), 0);
+            numa->execute([&](int node) {
+                for (Mesh *mesh : meshes)
+                    replicated[node] += mesh->replicate(node);
+            });
+            cout << "Replicated " << memString(replicated[0]) << " of mesh data per node ("
+                 << memString(replicated[0] * numa->getNodeCount()) << " in total)" << endl;
+        }
+    }
+
+    /* Render the views of all cameras, sharing the scene and thread pool */
+    std::thread outputThread;
+    size_t viewCount = scene->getCameraCount();
+    try {
+        for (size_t view=0; view<viewCount; ++view) {
+            scene->setActiveCamera(view);
+
+            std::string outputName = baseName;
+            if (viewCount > 1) {
+                outputName += tfm::format("_%04i", view);
+                cout << "View " << view + 1 << "/" << viewCount << ":" << endl;
+            }
+            if (options.isPartial() && options.outputName.empty()) {
+                if (options.tilePartCount > 1)
+                    outputName += tfm::format("_tiles%iof%i", options.tilePartIndex, options.tilePartCount);
+                if (options.passPartCount > 1)
+                    outputName += tfm::format("_passes%iof%i", options.passPartIndex, options.passPartCount);
+            }
+
+            renderView(scene, outputName, options, numa.get(), outputThread);
+        }
+    } catch (...) {
+        if (outputThread.joinable())
+            outputThread.join();
+        throw;
+    }
+
+    if (outputThread.joinable())
+        outputThread.join();
+}
+
+NORI_NAMESPACE_END
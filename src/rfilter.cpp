@@ -97,6 +97,8 @@ public:
     float eval(float x) const {
         return std::max(0.0f, 1.0f - std::abs(x));
     }
+
+    EShape getShape() const { return ETent; }
     
     std::string toString() const {
         return "TentFilter[]";
@@ -113,12 +115,41 @@ public:
     float eval(float) const {
         return 1.0f;
     }
+
+    EShape getShape() const { return EBox; }
     
     std::string toString() const {
         return "BoxFilter[]";
     }
 };
 
+FilterSampler::FilterSampler(const ReconstructionFilter *filter)
+        : m_filter(filter), m_pdf(NORI_FILTER_SAMPLING_RESOLUTION), m_radius(filter->getRadius()) {
+    /* Tabulate the absolute value of the filter on [-radius, radius] */
+    for (int i=0; i<NORI_FILTER_SAMPLING_RESOLUTION; ++i) {
+        float x = m_radius * (2 * (i + 0.5f) / NORI_FILTER_SAMPLING_RESOLUTION - 1);
+        m_pdf.append(std::abs(filter->eval(x)));
+    }
+    if (m_pdf.normalize() == 0)
+        throw NoriException("FilterSampler: the filter %s vanishes everywhere!", filter->toString());
+}
+
+float FilterSampler::sample1D(float sample, float &offset) const {
+    size_t index = m_pdf.sampleReuse(sample);
+    float binSize = 2 * m_radius / NORI_FILTER_SAMPLING_RESOLUTION;
+    offset = (index + sample) * binSize - m_radius;
+
+    /* Ratio of the filter and the sampling density, divided by the
+       integral of the filter's absolute value. This is about +1 (or -1
+       within negative lobes) and only deviates due to the tabulation */
+    float tabulated = m_pdf[index] * m_pdf.getSum();
+    return tabulated > 0 ? m_filter->eval(offset) / tabulated : 0.0f;
+}
+
+float FilterSampler::sample(const Point2f &sample, Vector2f &offset) const {
+    return sample1D(sample.x(), offset.x()) * sample1D(sample.y(), offset.y());
+}
+
 NORI_REGISTER_CLASS(GaussianFilter, "gaussian");
 NORI_REGISTER_CLASS(MitchellNetravaliFilter, "mitchell");
 NORI_REGISTER_CLASS(TentFilter, "tent");
@@ -0,0 +1,228 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/sampler.h>
+#include <algorithm>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Test of the stratification of low-discrepancy samplers
+ *
+ * For a few pixels and 2D dimensions, checks that every power-of-two
+ * prefix of the samples of a pixel is a (0, 2)-net in base 2, i.e. that
+ * every elementary interval of area <tt>1/n</tt> contains exactly one of
+ * the first \c n points. It also checks that <tt>generate(pixel, index)</tt>
+ * continues the sequence of the pixel exactly like the samples obtained by
+ * calling \ref Sampler::advance() \c index times (as progressive and
+ * adaptive passes rely on).
+ *
+ * Finally, it checks that \ref Sampler::generateBatch() returns the same
+ * values as \ref Sampler::next2D() for each of the samples, and that the
+ * following calls of \ref Sampler::next2D() continue with the subsequent
+ * dimension. Only this check applies to samplers that are listed after
+ * the first \c stratified ones (e.g. samplers without stratification).
+ */
+class SamplerTest : public NoriObject {
+public:
+    SamplerTest(const PropertyList &propList) {
+        /* Largest number of samples checked for stratification (log2) */
+        m_maxLog2Count = propList.getInteger("maxLog2Count", 8);
+
+        /* Number of 2D dimensions that are checked */
+        m_dimensions = propList.getInteger("dimensions", 4);
+
+        /* Sample index at which the continued sequence starts */
+        m_offset = propList.getInteger("offset", 32);
+
+        /* Number of samples generated in a batch */
+        m_batchCount = propList.getInteger("batchCount", 8);
+
+        /* Number of samplers whose stratification is checked (-1: all) */
+        m_stratified = propList.getInteger("stratified", -1);
+    }
+
+    virtual ~SamplerTest() {
+        for (auto sampler : m_samplers)
+            delete sampler;
+    }
+
+    void addChild(NoriObject *obj) {
+        switch (obj->getClassType()) {
+            case ESampler:
+                m_samplers.push_back(static_cast<Sampler *>(obj));
+                break;
+
+            default:
+                throw NoriException("SamplerTest::addChild(<%s>) is not supported!",
+                    classTypeName(obj->getClassType()));
+        }
+    }
+
+    void activate() {
+        int total = 0, passed = 0;
+        const Point2i pixels[] = {
+            Point2i(0, 0), Point2i(1, 0), Point2i(17, 5), Point2i(255, 1023)
+        };
+        uint32_t count = 1u << m_maxLog2Count;
+
+        for (size_t index = 0; index < m_samplers.size(); ++index) {
+            Sampler *sampler = m_samplers[index];
+            cout << "------------------------------------------------------" << endl;
+            cout << "Testing: " << sampler->toString() << endl;
+
+            for (const Point2i &pixel : pixels) {
+                /* Batches of samples and the dimension that follows them */
+                ++total;
+                if (checkBatch(sampler, pixel, (uint32_t) m_offset))
+                    ++passed;
+                else
+                    cout << tfm::format("Pixel %s: generateBatch(%i, 2) does not match "
+                        "next2D()!", pixel.toString(), m_batchCount) << endl;
+
+                if (m_stratified >= 0 && index >= (size_t) m_stratified)
+                    continue;
+
+                /* Stratification of the power-of-two prefixes */
+                std::vector<Point2f> points = getSamples(sampler, pixel, 0, count);
+                for (int dim = 0; dim < m_dimensions; ++dim) {
+                    ++total;
+                    int failed = -1;
+                    for (int m = 0; m <= m_maxLog2Count && failed < 0; ++m)
+                        if (!isNet(points, dim, m))
+                            failed = m;
+                    if (failed < 0)
+                        ++passed;
+                    else
+                        cout << tfm::format("Pixel %s, dimension %i: the first %i samples "
+                            "are not a (0, 2)-net!", pixel.toString(), dim, 1u << failed) << endl;
+                }
+
+                /* Continuing the sequence at a given sample index */
+                ++total;
+                std::vector<Point2f> continued = getSamples(sampler, pixel, (uint32_t) m_offset, count);
+                if (std::equal(continued.begin(), continued.end(),
+                               points.begin() + (size_t) m_offset * m_dimensions)) {
+                    ++passed;
+                } else {
+                    cout << tfm::format("Pixel %s: generate(pixel, %i) does not continue "
+                        "the sequence!", pixel.toString(), m_offset) << endl;
+                }
+            }
+        }
+
+        cout << "Passed " << passed << "/" << total << " tests." << endl;
+        if (passed < total)
+            throw std::runtime_error("Some tests failed :(");
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "SamplerTest[\n"
+            "  maxLog2Count = %i,\n"
+            "  dimensions = %i,\n"
+            "  offset = %i,\n"
+            "  batchCount = %i,\n"
+            "  stratified = %i\n"
+            "]",
+            m_maxLog2Count,
+            m_dimensions,
+            m_offset,
+            m_batchCount,
+            m_stratified
+        );
+    }
+
+    EClassType getClassType() const { return ETest; }
+
+protected:
+    /**
+     * \brief Return the 2D dimensions of the samples of a pixel (stored
+     * sample by sample), starting with \c sampleIndex and continuing up to
+     * (but excluding) \c end
+     */
+    std::vector<Point2f> getSamples(Sampler *sampler, const Point2i &pixel,
+                                    uint32_t sampleIndex, uint32_t end) const {
+        std::vector<Point2f> result;
+        sampler->generate(pixel, sampleIndex);
+        for (uint32_t i = sampleIndex; i < end; ++i) {
+            for (int dim = 0; dim < m_dimensions; ++dim)
+                result.push_back(sampler->next2D());
+            sampler->advance();
+        }
+        return result;
+    }
+
+    /**
+     * \brief Compare a batch of two 2D dimensions that starts at sample
+     * \c sampleIndex with the values returned by \ref Sampler::next2D()
+     * for each sample, including the third dimension, which must follow
+     * the batch
+     */
+    bool checkBatch(Sampler *sampler, const Point2i &pixel, uint32_t sampleIndex) const {
+        std::vector<Point2f> reference;
+        for (int i = 0; i < m_batchCount; ++i) {
+            sampler->generate(pixel, sampleIndex + (uint32_t) i);
+            for (int dim = 0; dim < 3; ++dim)
+                reference.push_back(sampler->next2D());
+        }
+
+        std::vector<Point2f> batch((size_t) m_batchCount * 2);
+        sampler->generate(pixel, sampleIndex);
+        sampler->generateBatch((uint32_t) m_batchCount, 2, batch.data());
+        for (int i = 0; i < m_batchCount; ++i) {
+            if (batch[2 * i] != reference[3 * i] ||
+                batch[2 * i + 1] != reference[3 * i + 1] ||
+                sampler->next2D() != reference[3 * i + 2])
+                return false;
+            sampler->advance();
+        }
+        return true;
+    }
+
+    /// Are the first 2^m points of a dimension a (0, 2)-net in base 2?
+    bool isNet(const std::vector<Point2f> &points, int dim, int m) const {
+        uint32_t n = 1u << m;
+        std::vector<bool> occupied;
+        for (int a = 0; a <= m; ++a) {
+            /* Elementary intervals of size 2^-a x 2^-(m-a) */
+            occupied.assign(n, false);
+            for (uint32_t i = 0; i < n; ++i) {
+                const Point2f &p = points[(size_t) i * m_dimensions + dim];
+                uint32_t x = std::min((uint32_t) (p.x() * (1u << a)), (1u << a) - 1);
+                uint32_t y = std::min((uint32_t) (p.y() * (1u << (m - a))), (1u << (m - a)) - 1);
+                uint32_t cell = (x << (m - a)) | y;
+                if (occupied[cell])
+                    return false;
+                occupied[cell] = true;
+            }
+        }
+        return true;
+    }
+
+private:
+    std::vector<Sampler *> m_samplers;
+    int m_maxLog2Count;
+    int m_dimensions;
+    int m_offset;
+    int m_batchCount;
+    int m_stratified;
+};
+
+NORI_REGISTER_CLASS(SamplerTest, "samplertest");
+NORI_NAMESPACE_END
@@ -30,9 +30,12 @@ Scene::Scene(const PropertyList &) {
 }
 
 Scene::~Scene() {
+    for (Mesh *mesh : m_meshes)
+        delete mesh;
     delete m_accel;
     delete m_sampler;
-    delete m_camera;
+    for (Camera *camera : m_cameras)
+        delete camera;
     delete m_integrator;
 }
 
@@ -41,7 +44,7 @@ void Scene::activate() {
 
     if (!m_integrator)
         throw NoriException("No integrator was specified!");
-    if (!m_camera)
+    if (m_cameras.empty())
         throw NoriException("No camera was specified!");
     
     if (!m_sampler) {
@@ -55,6 +58,12 @@ void Scene::activate() {
     cout << endl;
 }
 
+void Scene::setActiveCamera(size_t index) {
+    if (index >= m_cameras.size())
+        throw NoriException("Scene::setActiveCamera(): invalid camera index %i!", index);
+    m_activeCamera = index;
+}
+
 void Scene::addChild(NoriObject *obj) {
     switch (obj->getClassType()) {
         case EMesh: {
@@ -78,9 +87,7 @@ void Scene::addChild(NoriObject *obj) {
             break;
 
         case ECamera:
-            if (m_camera)
-                throw NoriException("There can only be one camera per scene!");
-            m_camera = static_cast<Camera *>(obj);
+            m_cameras.push_back(static_cast<Camera *>(obj));
             break;
         
         case EIntegrator:
@@ -96,6 +103,14 @@ void Scene::addChild(NoriObject *obj) {
 }
 
 std::string Scene::toString() const {
+    std::string cameras;
+    for (size_t i=0; i<m_cameras.size(); ++i) {
+        cameras += std::string("  ") + indent(m_cameras[i]->toString(), 2);
+        if (i + 1 < m_cameras.size())
+            cameras += ",";
+        cameras += "\n";
+    }
+
     std::string meshes;
     for (size_t i=0; i<m_meshes.size(); ++i) {
         meshes += std::string("  ") + indent(m_meshes[i]->toString(), 2);
@@ -108,13 +123,14 @@ std::string Scene::toString() const {
         "Scene[\n"
         "  integrator = %s,\n"
         "  sampler = %s\n"
-        "  camera = %s,\n"
+        "  cameras = {\n"
+        "  %s  },\n"
         "  meshes = {\n"
         "  %s  }\n"
         "]",
         indent(m_integrator->toString()),
         indent(m_sampler->toString()),
-        indent(m_camera->toString()),
+        indent(cameras, 2),
         indent(meshes, 2)
     );
 }
@@ -0,0 +1,139 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/sampler.h>
+#include <nori/hash.h>
+#include <nori/bluenoise.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Owen-scrambled Sobol sampler
+ *
+ * Generates the points of the first two dimensions of the Sobol sequence,
+ * which form a (0, 2)-sequence in base 2, using the hash-based Owen
+ * scrambling by Burley ("Practical Hash-based Owen Scrambling", JCGT 2020).
+ *
+ * Every 1D or 2D request consumes one dimension (pair) of the sample. The
+ * dimensions are decorrelated by additionally shuffling the sample index
+ * with a nested uniform scramble, which preserves the stratification of
+ * each dimension but pads them independently. All scrambles are seeded by
+ * hashing the pixel coordinates, the dimension and the \c seed property,
+ * so every pixel receives its own decorrelated sequence.
+ *
+ * Alternatively, the \c blueNoise property makes all pixels use the same
+ * sequence, digitally shifted by a blue noise dither mask (see \ref
+ * getBlueNoiseMask()). This distributes the error of low sample count
+ * renders as blue noise, which is perceptually less objectionable.
+ *
+ * The sampler is stateless with respect to image blocks: the sample
+ * index passed to \ref generate() continues the sequence of a pixel in
+ * later (progressive or adaptive) passes. Sample counts that are powers
+ * of two give the best stratification.
+ */
+class Sobol : public Sampler {
+public:
+    Sobol(const PropertyList &propList) {
+        m_sampleCount = (size_t) propList.getInteger("sampleCount", 1);
+        m_seed = (uint32_t) propList.getInteger("seed", 0);
+        m_blueNoise = propList.getBoolean("blueNoise", false);
+    }
+
+    std::unique_ptr<Sampler> clone() const {
+        std::unique_ptr<Sobol> cloned(new Sobol());
+        cloned->m_sampleCount = m_sampleCount;
+        cloned->m_seed = m_seed;
+        cloned->m_blueNoise = m_blueNoise;
+        return std::move(cloned);
+    }
+
+    void prepare(const ImageBlock &, uint32_t) { /* No-op for this sampler */ }
+
+    void generate(const Point2i &pixel, uint32_t sampleIndex) {
+        /* With blue noise dithering, all pixels share the same sequence
+           and are decorrelated by the dither mask instead */
+        m_pixel = pixel;
+        m_pixelSeed = m_blueNoise ? hashInt(m_seed)
+            : hashCombine(hashCombine(m_seed, (uint32_t) pixel.x()), (uint32_t) pixel.y());
+        m_sampleIndex = sampleIndex;
+        m_dimension = m_firstDimension = 0;
+    }
+
+    void advance() {
+        m_sampleIndex++;
+        m_dimension = m_firstDimension;
+    }
+
+    float next1D() {
+        uint32_t dimension = m_dimension++;
+        uint32_t seed = hashCombine(m_pixelSeed, dimension);
+        uint32_t index = nestedUniformScramble(m_sampleIndex, seed);
+        return fractionToFloat(dither(nestedUniformScramble(reverseBits(index), hashInt(seed)),
+                                      2 * dimension));
+    }
+
+    Point2f next2D() {
+        uint32_t dimension = m_dimension++;
+        uint32_t seed = hashCombine(m_pixelSeed, dimension);
+        uint32_t index = nestedUniformScramble(m_sampleIndex, seed);
+        uint32_t seedX = hashInt(seed), seedY = hashInt(seedX);
+        return Point2f(
+            fractionToFloat(dither(nestedUniformScramble(reverseBits(index), seedX), 2 * dimension)),
+            fractionToFloat(dither(nestedUniformScramble(sobol1(index), seedY), 2 * dimension + 1))
+        );
+    }
+
+    std::string toString() const {
+        return tfm::format("Sobol[sampleCount=%i, seed=%i, blueNoise=%s]",
+                           m_sampleCount, m_seed, m_blueNoise ? "true" : "false");
+    }
+
+protected:
+    Sobol() { }
+
+    void rewind(uint32_t count, uint32_t dimension) {
+        m_sampleIndex -= count;
+        m_dimension = m_firstDimension = dimension;
+    }
+
+    /// Second dimension of the Sobol sequence (direction numbers of the polynomial x + 1)
+    static uint32_t sobol1(uint32_t index) {
+        uint32_t result = 0, v = 1u << 31;
+        for (; index; index >>= 1, v ^= v >> 1)
+            if (index & 1)
+                result ^= v;
+        return result;
+    }
+
+    /// Apply the blue noise dither mask (if enabled) to a sample component
+    uint32_t dither(uint32_t value, uint32_t component) const {
+        return m_blueNoise ? value ^ getBlueNoiseMask(m_pixel, component) : value;
+    }
+
+private:
+    uint32_t m_seed = 0;
+    bool m_blueNoise = false;
+    Point2i m_pixel = Point2i::Zero();
+    uint32_t m_pixelSeed = 0;
+    uint32_t m_sampleIndex = 0;
+    uint32_t m_dimension = 0;
+    uint32_t m_firstDimension = 0;
+};
+
+NORI_REGISTER_CLASS(Sobol, "sobol");
+NORI_NAMESPACE_END
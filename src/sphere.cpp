@@ -0,0 +1,167 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/mesh.h>
+#include <nori/bsdf.h>
+#include <nori/emitter.h>
+#include <nori/timer.h>
+#include <filesystem/resolver.h>
+#include <fstream>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Analytic sphere shape
+ *
+ * Represents one or more spheres that are intersected exactly instead
+ * of being tessellated. Each sphere is stored as a center and a radius
+ * (16 bytes). A single sphere is specified using the \c center and
+ * \c radius properties. Alternatively, \c filename references a binary
+ * file containing a flat array of 32-bit floating point quadruples
+ * <tt>(x, y, z, radius)</tt>, which is useful for particle data.
+ */
+class Sphere : public Mesh {
+public:
+    Sphere(const PropertyList &propList) {
+        if (propList.getString("filename", "").empty()) {
+            m_spheres.resize(4, 1);
+            m_spheres.col(0) <<
+                propList.getPoint("center", Point3f(0.0f)),
+                propList.getFloat("radius", 1.0f);
+            m_name = "sphere";
+        } else {
+            filesystem::path filename =
+                getFileResolver()->resolve(propList.getString("filename"));
+
+            std::ifstream is(filename.str(), std::ios::binary | std::ios::ate);
+            if (is.fail())
+                throw NoriException("Unable to open sphere file \"%s\"!", filename);
+
+            /* Shapes may be loaded in parallel, so the message is printed at the end */
+            Timer timer;
+
+            size_t size = (size_t) is.tellg();
+            if (size % (4 * sizeof(float)) != 0)
+                throw NoriException("Sphere file \"%s\" has an invalid size!", filename);
+            is.seekg(0);
+
+            m_spheres.resize(4, size / (4 * sizeof(float)));
+            is.read(reinterpret_cast<char *>(m_spheres.data()), size);
+            if (is.fail())
+                throw NoriException("Unable to read sphere file \"%s\"!", filename);
+
+            m_name = filename.str();
+            logMessage(tfm::format("Loading \"%s\" .. done. (N=%i, took %s and %s)",
+                filename, m_spheres.cols(), timer.elapsedString(),
+                memString(m_spheres.size() * sizeof(float))));
+        }
+
+        for (uint32_t i=0; i<getPrimitiveCount(); ++i) {
+            if (!(m_spheres(3, i) > 0))
+                throw NoriException("Sphere %i has an invalid radius!", i);
+            m_bbox.expandBy(getBoundingBox(i));
+        }
+    }
+
+    uint32_t getPrimitiveCount() const { return (uint32_t) m_spheres.cols(); }
+
+    float surfaceArea(uint32_t index) const {
+        float radius = m_spheres(3, index);
+        return 4 * M_PI * radius * radius;
+    }
+
+    BoundingBox3f getBoundingBox(uint32_t index) const {
+        Point3f center = m_spheres.col(index).head<3>();
+        Vector3f extents = Vector3f::Constant(m_spheres(3, index));
+        return BoundingBox3f(center - extents, center + extents);
+    }
+
+    Point3f getCentroid(uint32_t index) const {
+        return m_spheres.col(index).head<3>();
+    }
+
+    bool rayIntersect(uint32_t index, const Ray3f &ray, float &u, float &v, float &t) const {
+        Point3f center = m_spheres.col(index).head<3>();
+        float radius = m_spheres(3, index);
+
+        /* Solve |o + t*d - center|^2 = radius^2. The discriminant is computed
+           from the distance between the center and the ray (instead of
+           B^2 - A*C) to avoid cancellation for small or distant spheres */
+        Vector3f o = ray.o - center;
+        float A = ray.d.squaredNorm(),
+              B = o.dot(ray.d),
+              C = o.squaredNorm() - radius * radius;
+
+        Vector3f l = o - (B / A) * ray.d;
+        float discrim = A * (radius * radius - l.squaredNorm());
+        if (discrim < 0)
+            return false;
+
+        float q = -(B + std::copysign(std::sqrt(discrim), B));
+        float t0 = C / q, t1 = q / A;
+        if (t0 > t1)
+            std::swap(t0, t1);
+
+        if (t0 >= ray.mint && t0 <= ray.maxt)
+            t = t0;
+        else if (t1 >= ray.mint && t1 <= ray.maxt)
+            t = t1;
+        else
+            return false;
+
+        u = v = 0.0f;
+        return true;
+    }
+
+    void setHitInformation(uint32_t index, const Ray3f &ray, Intersection &its) const {
+        Point3f center = m_spheres.col(index).head<3>();
+        float radius = m_spheres(3, index);
+
+        /* Reproject the intersection onto the sphere surface */
+        Vector3f n = (ray(its.t) - center).normalized();
+        its.p = center + radius * n;
+        its.mesh = this;
+
+        /* Texture coordinates from the spherical coordinates of the normal */
+        Point2f sph = sphericalCoordinates(n);
+        its.uv = Point2f(sph.y() * INV_TWOPI, sph.x() * INV_PI);
+
+        its.geoFrame = its.shFrame = Frame(n);
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "Sphere[\n"
+            "  name = \"%s\",\n"
+            "  sphereCount = %i,\n"
+            "  bsdf = %s,\n"
+            "  emitter = %s\n"
+            "]",
+            m_name,
+            m_spheres.cols(),
+            m_bsdf ? indent(m_bsdf->toString()) : std::string("null"),
+            m_emitter ? indent(m_emitter->toString()) : std::string("null")
+        );
+    }
+
+private:
+    MatrixXf m_spheres; ///< Center and radius of each sphere
+};
+
+NORI_REGISTER_CLASS(Sphere, "sphere");
+NORI_NAMESPACE_END
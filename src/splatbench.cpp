@@ -0,0 +1,167 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/block.h>
+#include <nori/rfilter.h>
+#include <nori/timer.h>
+#include <pcg32.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Splatting benchmark and test
+ *
+ * Measures how many samples per second \ref ImageBlock::put() records
+ * into a block for each of the given reconstruction filters. It also
+ * checks the filter weights that were accumulated against a direct
+ * evaluation of the filter and fails if they differ by more than the
+ * tabulation error.
+ */
+class SplatBenchmark : public NoriObject {
+public:
+    SplatBenchmark(const PropertyList &propList) {
+        /* Number of samples that are splatted per filter (default: 10M) */
+        m_sampleCount = propList.getInteger("sampleCount", 10000000);
+
+        /* Number of samples used to check the weights */
+        m_testCount = propList.getInteger("testCount", 1000);
+
+        /* Maximum relative deviation of the accumulated weights (generous,
+           as the block uses a filter tabulated at a low resolution) */
+        m_tolerance = propList.getFloat("tolerance", 0.15f);
+    }
+
+    virtual ~SplatBenchmark() {
+        for (auto filter : m_filters)
+            delete filter;
+    }
+
+    void addChild(NoriObject *obj) {
+        switch (obj->getClassType()) {
+            case EReconstructionFilter:
+                m_filters.push_back(static_cast<ReconstructionFilter *>(obj));
+                break;
+
+            default:
+                throw NoriException("SplatBenchmark::addChild(<%s>) is not supported!",
+                    classTypeName(obj->getClassType()));
+        }
+    }
+
+    void activate() {
+        int total = 0, passed = 0;
+        const Vector2i size(NORI_BLOCK_SIZE, NORI_BLOCK_SIZE);
+
+        /* Generate the sample positions and values up front */
+        pcg32 random;
+        std::vector<Point2f> positions(m_sampleCount);
+        std::vector<Color3f> values(m_sampleCount);
+        for (int i=0; i<m_sampleCount; ++i) {
+            positions[i] = Point2f(random.nextFloat() * size.x(), random.nextFloat() * size.y());
+            values[i] = Color3f(random.nextFloat(), random.nextFloat(), random.nextFloat());
+        }
+
+        for (auto filter : m_filters) {
+            cout << "------------------------------------------------------" << endl;
+            cout << "Testing: " << filter->toString() << endl;
+            ++total;
+
+            ImageBlock block(size, filter);
+            block.clear();
+            Timer timer;
+            for (int i=0; i<m_sampleCount; ++i)
+                block.put(positions[i], values[i]);
+            double elapsed = timer.elapsed();
+            cout << tfm::format("Splatted %i samples in %s (%.2f M samples/sec)",
+                m_sampleCount, timeString(elapsed),
+                m_sampleCount / (elapsed * 1000.0)) << endl;
+
+            if (checkWeights(filter, positions)) {
+                ++passed;
+                cout << "Filter weights: passed" << endl;
+            } else {
+                cout << "Filter weights: failed" << endl;
+            }
+        }
+
+        cout << "Passed " << passed << "/" << total << " tests." << endl;
+        if (passed < total)
+            throw std::runtime_error("Some tests failed :(");
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "SplatBenchmark[\n"
+            "  sampleCount = %i,\n"
+            "  testCount = %i,\n"
+            "  tolerance = %f\n"
+            "]",
+            m_sampleCount,
+            m_testCount,
+            m_tolerance
+        );
+    }
+
+    EClassType getClassType() const { return ETest; }
+
+protected:
+    /// Compare the accumulated weights of a few samples against the filter
+    bool checkWeights(const ReconstructionFilter *filter,
+                      const std::vector<Point2f> &positions) const {
+        const Vector2i size(NORI_BLOCK_SIZE, NORI_BLOCK_SIZE);
+        ImageBlock block(size, filter);
+        block.clear();
+        int border = block.getBorderSize();
+        int count = std::min(m_testCount, (int) positions.size());
+
+        /* Reference weights of every pixel (including the border) */
+        Eigen::MatrixXf reference = Eigen::MatrixXf::Zero(block.rows(), block.cols());
+        float radius = filter->getRadius();
+        for (int i=0; i<count; ++i) {
+            const Point2f &p = positions[i];
+            block.put(p, Color3f(1.0f));
+            for (int y=0; y<block.rows(); ++y) {
+                float dy = std::abs(y - border + 0.5f - p.y());
+                if (dy > radius)
+                    continue;
+                for (int x=0; x<block.cols(); ++x) {
+                    float dx = std::abs(x - border + 0.5f - p.x());
+                    if (dx <= radius)
+                        reference(y, x) += filter->eval(dx) * filter->eval(dy);
+                }
+            }
+        }
+
+        float maxWeight = reference.maxCoeff(), maxError = 0;
+        for (int y=0; y<block.rows(); ++y)
+            for (int x=0; x<block.cols(); ++x)
+                maxError = std::max(maxError, std::abs(block.coeff(y, x).w() - reference(y, x)));
+        cout << tfm::format("Maximum weight error: %f (relative: %f)",
+            maxError, maxError / maxWeight) << endl;
+        return maxError <= m_tolerance * maxWeight;
+    }
+
+private:
+    std::vector<ReconstructionFilter *> m_filters;
+    int m_sampleCount;
+    int m_testCount;
+    float m_tolerance;
+};
+
+NORI_REGISTER_CLASS(SplatBenchmark, "splatbench");
+NORI_NAMESPACE_END
@@ -0,0 +1,118 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/sampler.h>
+#include <nori/hash.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Stateless sampler based on a counter-based hash function
+ *
+ * Returns independent uniformly distributed random numbers like the
+ * \ref Independent sampler, but every value is a pure function of the
+ * pixel, the sample index, the dimension and the \c seed property. The
+ * result therefore does not depend on the block size, on how blocks are
+ * scheduled, or on whether a render was split up, resumed or distributed
+ * across machines: all of these produce bitwise identical images.
+ *
+ * One evaluation of the hash yields four 32-bit values, which serve two
+ * consecutive 2D requests (or four 1D requests).
+ */
+class Stateless : public Sampler {
+public:
+    Stateless(const PropertyList &propList) {
+        m_sampleCount = (size_t) propList.getInteger("sampleCount", 1);
+        m_seed = (uint32_t) propList.getInteger("seed", 0);
+    }
+
+    std::unique_ptr<Sampler> clone() const {
+        std::unique_ptr<Stateless> cloned(new Stateless());
+        cloned->m_sampleCount = m_sampleCount;
+        cloned->m_seed = m_seed;
+        return std::move(cloned);
+    }
+
+    void prepare(const ImageBlock &, uint32_t) { /* No-op for this sampler */ }
+
+    void generate(const Point2i &pixel, uint32_t sampleIndex) {
+        m_pixel = pixel;
+        m_sampleIndex = sampleIndex;
+        m_dimension = m_firstDimension = 0;
+        m_cachedBlock = NoBlock;
+    }
+
+    void advance() {
+        m_sampleIndex++;
+        m_dimension = m_firstDimension;
+        m_cachedBlock = NoBlock;
+    }
+
+    float next1D() {
+        return fractionToFloat(nextUInt());
+    }
+
+    Point2f next2D() {
+        /* Keep both values in the same hash evaluation */
+        m_dimension = (m_dimension + 1) & ~1u;
+        uint32_t x = nextUInt(), y = nextUInt();
+        return Point2f(fractionToFloat(x), fractionToFloat(y));
+    }
+
+    std::string toString() const {
+        return tfm::format("Stateless[sampleCount=%i, seed=%i]", m_sampleCount, m_seed);
+    }
+
+protected:
+    Stateless() { }
+
+    static const uint32_t NoBlock = 0xFFFFFFFFu;
+
+    void rewind(uint32_t count, uint32_t dimension) {
+        /* Every 2D component consumes two values */
+        m_sampleIndex -= count;
+        m_dimension = m_firstDimension = 2 * dimension;
+        m_cachedBlock = NoBlock;
+    }
+
+    /// Return the 32-bit value of the next dimension
+    uint32_t nextUInt() {
+        uint32_t dimension = m_dimension++;
+        if (dimension / 4 != m_cachedBlock) {
+            m_values[0] = (uint32_t) m_pixel.x();
+            m_values[1] = (uint32_t) m_pixel.y();
+            m_values[2] = m_sampleIndex;
+            m_values[3] = hashCombine(m_seed, dimension / 4);
+            pcg4d(m_values);
+            m_cachedBlock = dimension / 4;
+        }
+        return m_values[dimension % 4];
+    }
+
+private:
+    uint32_t m_seed = 0;
+    Point2i m_pixel = Point2i::Zero();
+    uint32_t m_sampleIndex = 0;
+    uint32_t m_dimension = 0;
+    uint32_t m_firstDimension = 0;
+    uint32_t m_cachedBlock = NoBlock;
+    uint32_t m_values[4];
+};
+
+NORI_REGISTER_CLASS(Stateless, "stateless");
+NORI_NAMESPACE_END